@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <eigen3/Eigen/Eigen>
+
+// The 2x2 quads step their edge values with SSE2, or AVX2 when the compiler
+// targets it; RASTERIZER_NO_SIMD keeps them scalar
+#if !defined(RASTERIZER_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define RASTERIZER_AVX2
+#elif !defined(RASTERIZER_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTERIZER_SSE2
+#endif
+
+namespace rst
+{
+    // Edge equations of a screen space triangle, set up once in fixed point
+    // with subpixel_bits fraction bits. Edge i faces vertex i: E_i(X, Y) =
+    // a[i] * X + b[i] * Y + c[i] is positive inside the triangle, and E_i /
+    // area is the screen space barycentric coordinate of vertex i. A pixel
+    // center on an edge is inside if the edge is a top or a left one, so of
+    // two triangles sharing an edge exactly one draws it.
+    struct TriangleSetup
+    {
+        static constexpr int subpixel_bits = 4;
+        static constexpr int64_t one = int64_t(1) << subpixel_bits;
+
+        int64_t a[3], b[3], c[3];
+        // 0 on top and left edges, -1 on the others: E_i + bias[i] >= 0 inside
+        int64_t bias[3];
+        int64_t area;
+        float inv_area;
+        float inv_w[3];
+        float z[3];
+
+        // False for triangles without area and for the ones reaching further
+        // than 2^24 pixels off the screen, which the fixed point can not hold
+        bool setup(const Eigen::Vector4f* v)
+        {
+            int64_t x[3], y[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                if (!(std::abs(v[i].x()) < 0x1p24f && std::abs(v[i].y()) < 0x1p24f))
+                    return false;
+                x[i] = std::llround(v[i].x() * one);
+                y[i] = std::llround(v[i].y() * one);
+                inv_w[i] = 1.f / v[i].w();
+                z[i] = v[i].z();
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                int j = (i + 1) % 3, k = (i + 2) % 3;
+                a[i] = y[j] - y[k];
+                b[i] = x[k] - x[j];
+                c[i] = x[j] * y[k] - x[k] * y[j];
+            }
+            area = a[0] * x[0] + b[0] * y[0] + c[0];
+            if (area == 0)
+                return false;
+            // either winding is drawn, clockwise triangles flip their edges
+            if (area < 0)
+            {
+                for (int i = 0; i < 3; ++i)
+                    a[i] = -a[i], b[i] = -b[i], c[i] = -c[i];
+                area = -area;
+            }
+            inv_area = 1.f / area;
+            // y points up: left edges run down (a > 0), top edges run to -x
+            for (int i = 0; i < 3; ++i)
+                bias[i] = a[i] > 0 || (a[i] == 0 && b[i] < 0) ? 0 : -1;
+            return true;
+        }
+
+        // E_i at the center of pixel (x, y)
+        int64_t edge(int i, int x, int y) const
+        {
+            return a[i] * (x * one + one / 2) + b[i] * (y * one + one / 2) + c[i];
+        }
+
+        // True if no pixel center of the size x size block from (x, y) is inside
+        bool outside(int x, int y, int size) const
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                int64_t reach = (std::max<int64_t>(a[i], 0) + std::max<int64_t>(b[i], 0)) * (size - 1) * one;
+                if (edge(i, x, y) + reach + bias[i] < 0)
+                    return true;
+            }
+            return false;
+        }
+
+        // Perspective correct barycentric coordinates of a pixel from its
+        // edge values, and its depth interpolated with them
+        void barycentric(const int64_t* e, float* weight, float& depth) const
+        {
+            float w[3], sum = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                w[i] = e[i] * inv_area * inv_w[i];
+                sum += w[i];
+            }
+            float Z = 1 / sum;
+            depth = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                weight[i] = w[i] * Z;
+                depth += weight[i] * z[i];
+            }
+        }
+    };
+
+    // Edge values of the 2x2 pixel quad from (x, y), lanes (x, y), (x + 1, y),
+    // (x, y + 1), (x + 1, y + 1). step() moves two pixels right with one add
+    // per edge.
+    class QuadEdges
+    {
+    public:
+        QuadEdges(const TriangleSetup& t, int x, int y)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                bias[i] = t.bias[i];
+                int64_t e = t.edge(i, x, y) + t.bias[i];
+                int64_t dx = t.a[i] * TriangleSetup::one, dy = t.b[i] * TriangleSetup::one;
+#if defined(RASTERIZER_AVX2)
+                lanes[i] = _mm256_setr_epi64x(e, e + dx, e + dy, e + dx + dy);
+                steps[i] = _mm256_set1_epi64x(2 * dx);
+#elif defined(RASTERIZER_SSE2)
+                lanes[i][0] = _mm_set_epi64x(e + dx, e);
+                lanes[i][1] = _mm_set_epi64x(e + dx + dy, e + dy);
+                steps[i] = _mm_set1_epi64x(2 * dx);
+#else
+                lanes[i][0] = e, lanes[i][1] = e + dx, lanes[i][2] = e + dy, lanes[i][3] = e + dx + dy;
+                steps[i] = 2 * dx;
+#endif
+            }
+        }
+
+        void step()
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+#if defined(RASTERIZER_AVX2)
+                lanes[i] = _mm256_add_epi64(lanes[i], steps[i]);
+#elif defined(RASTERIZER_SSE2)
+                lanes[i][0] = _mm_add_epi64(lanes[i][0], steps[i]);
+                lanes[i][1] = _mm_add_epi64(lanes[i][1], steps[i]);
+#else
+                for (int k = 0; k < 4; ++k)
+                    lanes[i][k] += steps[i];
+#endif
+            }
+        }
+
+        // Bit k is set if lane k is inside: no edge value has its sign bit set
+        int mask() const
+        {
+#if defined(RASTERIZER_AVX2)
+            __m256i any = _mm256_or_si256(_mm256_or_si256(lanes[0], lanes[1]), lanes[2]);
+            return ~_mm256_movemask_pd(_mm256_castsi256_pd(any)) & 15;
+#elif defined(RASTERIZER_SSE2)
+            __m128i lo = _mm_or_si128(_mm_or_si128(lanes[0][0], lanes[1][0]), lanes[2][0]);
+            __m128i hi = _mm_or_si128(_mm_or_si128(lanes[0][1], lanes[1][1]), lanes[2][1]);
+            int outside = _mm_movemask_pd(_mm_castsi128_pd(lo)) | _mm_movemask_pd(_mm_castsi128_pd(hi)) << 2;
+            return ~outside & 15;
+#else
+            int inside = 0;
+            for (int k = 0; k < 4; ++k)
+                if ((lanes[0][k] | lanes[1][k] | lanes[2][k]) >= 0)
+                    inside |= 1 << k;
+            return inside;
+#endif
+        }
+
+        // The edge values E_i of lane k in e[k][i]
+        void store(int64_t e[4][3]) const
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                alignas(32) int64_t lane[4];
+#if defined(RASTERIZER_AVX2)
+                _mm256_store_si256((__m256i*)lane, lanes[i]);
+#elif defined(RASTERIZER_SSE2)
+                _mm_store_si128((__m128i*)lane, lanes[i][0]);
+                _mm_store_si128((__m128i*)lane + 1, lanes[i][1]);
+#else
+                std::copy(lanes[i], lanes[i] + 4, lane);
+#endif
+                for (int k = 0; k < 4; ++k)
+                    e[k][i] = lane[k] - bias[i];
+            }
+        }
+
+    private:
+        int64_t bias[3];
+#if defined(RASTERIZER_AVX2)
+        __m256i lanes[3], steps[3];
+#elif defined(RASTERIZER_SSE2)
+        __m128i lanes[3][2], steps[3];
+#else
+        int64_t lanes[3][4], steps[3];
+#endif
+    };
+}
@@ -367,6 +367,30 @@ Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload)
     return result_color * 255.f;
 }
 
+// Draws with Shader inlined into the rasterizer's pixel loop
+template <Eigen::Vector3f (*Shader)(const fragment_shader_payload&)>
+void draw_inlined(rst::rasterizer& r, std::vector<Triangle*>& TriangleList)
+{
+    r.draw(TriangleList, [](const fragment_shader_payload& payload) { return Shader(payload); });
+}
+
+// The shaders that can be picked by name, each with the draw call that
+// inlines it
+struct ShaderEntry
+{
+    const char* name;
+    Eigen::Vector3f (*shader)(const fragment_shader_payload&);
+    void (*draw)(rst::rasterizer&, std::vector<Triangle*>&);
+};
+
+const ShaderEntry shaders[] = {
+    {"texture", texture_fragment_shader, draw_inlined<texture_fragment_shader>},
+    {"normal", normal_fragment_shader, draw_inlined<normal_fragment_shader>},
+    {"phong", phong_fragment_shader, draw_inlined<phong_fragment_shader>},
+    {"bump", bump_fragment_shader, draw_inlined<bump_fragment_shader>},
+    {"displacement", displacement_fragment_shader, draw_inlined<displacement_fragment_shader>},
+};
+
 int main(int argc, const char** argv)
 {
     std::vector<Triangle*> TriangleList;
@@ -403,46 +427,39 @@ int main(int argc, const char** argv)
     r.set_texture(Texture(obj_path + texture_path));
 
     // ǰЧɫ
-    std::function<Eigen::Vector3f(fragment_shader_payload)> active_shader = displacement_fragment_shader;
+    const ShaderEntry* active_shader = nullptr;
+    std::string shader_name = "displacement";
 
     if (argc >= 2)
     {
         command_line = true;
         filename = std::string(argv[1]);
-
-        if (argc == 3 && std::string(argv[2]) == "texture")
-        {
-            std::cout << "Rasterizing using the texture shader\n";
-            active_shader = texture_fragment_shader;
-            texture_path = "spot_texture.png";
-            r.set_texture(Texture(obj_path + texture_path));
-        }
-        else if (argc == 3 && std::string(argv[2]) == "normal")
-        {
-            std::cout << "Rasterizing using the normal shader\n";
-            active_shader = normal_fragment_shader;
-        }
-        else if (argc == 3 && std::string(argv[2]) == "phong")
-        {
-            std::cout << "Rasterizing using the phong shader\n";
-            active_shader = phong_fragment_shader;
-        }
-        else if (argc == 3 && std::string(argv[2]) == "bump")
-        {
-            std::cout << "Rasterizing using the bump shader\n";
-            active_shader = bump_fragment_shader;
-        }
-        else if (argc == 3 && std::string(argv[2]) == "displacement")
-        {
-            std::cout << "Rasterizing using the bump shader\n";
-            active_shader = displacement_fragment_shader;
-        }
+        if (argc >= 3)
+            shader_name = std::string(argv[2]);
+    }
+    for (const ShaderEntry& entry : shaders)
+    {
+        if (shader_name == entry.name)
+            active_shader = &entry;
     }
+    if (!active_shader)
+    {
+        std::cerr << "Unknown shader " << shader_name << ", expected one of:";
+        for (const ShaderEntry& entry : shaders)
+            std::cerr << " " << entry.name;
+        std::cerr << "\n";
+        return 1;
+    }
+    if (command_line)
+        std::cout << "Rasterizing using the " << shader_name << " shader\n";
 
     Eigen::Vector3f eye_pos = {0,0,10};
 
     r.set_vertex_shader(vertex_shader);
-    r.set_fragment_shader(active_shader);
+    r.set_fragment_shader(active_shader->shader);
+    // Rasterizer output.png phong deferred: shade every pixel once
+    if (argc >= 4 && std::string(argv[3]) == "deferred")
+        r.set_deferred(true);
 
     int key = 0;
     int frame_count = 0;
@@ -454,7 +471,7 @@ int main(int argc, const char** argv)
         r.set_view(get_view_matrix(eye_pos));
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-        r.draw(TriangleList);
+        active_shader->draw(r, TriangleList);
         cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
         image.convertTo(image, CV_8UC3, 1.0f);
         cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
@@ -473,7 +490,7 @@ int main(int argc, const char** argv)
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
         //r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-        r.draw(TriangleList);
+        active_shader->draw(r, TriangleList);
         cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
         image.convertTo(image, CV_8UC3, 1.0f);
         cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
@@ -149,175 +149,164 @@ auto to_vec4(const Eigen::Vector3f& v3, float w = 1.0f)
     return Vector4f(v3.x(), v3.y(), v3.z(), w);
 }
 
-static bool insideTriangle(int x, int y, const Vector4f* _v){
-    Vector3f v[3];
-    for(int i=0;i<3;i++)
-        v[i] = {_v[i].x(),_v[i].y(), 1.0};
-    Vector3f f0,f1,f2;
-    f0 = v[1].cross(v[0]);
-    f1 = v[2].cross(v[1]);
-    f2 = v[0].cross(v[2]);
-    Vector3f p(x,y,1.);
-    if((p.dot(f0)*f0.dot(v[2])>0) && (p.dot(f1)*f1.dot(v[0])>0) && (p.dot(f2)*f2.dot(v[1])>0))
-        return true;
-    return false;
-}
-
-static std::tuple<float, float, float> computeBarycentric2D(float x, float y, const Vector4f* v){
-    float c1 = (x*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*y + v[1].x()*v[2].y() - v[2].x()*v[1].y()) / (v[0].x()*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*v[0].y() + v[1].x()*v[2].y() - v[2].x()*v[1].y());
-    float c2 = (x*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*y + v[2].x()*v[0].y() - v[0].x()*v[2].y()) / (v[1].x()*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*v[1].y() + v[2].x()*v[0].y() - v[0].x()*v[2].y());
-    float c3 = (x*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*y + v[0].x()*v[1].y() - v[1].x()*v[0].y()) / (v[2].x()*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*v[2].y() + v[0].x()*v[1].y() - v[1].x()*v[0].y());
-    return {c1,c2,c3};
+void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList)
+{
+    draw(TriangleList, fragment_shader);
 }
 
-void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList) {
+// Transforms the triangles into screen_triangles and bins them, returns the
+// number of threads to draw the tiles with
+int rst::rasterizer::vertex_stage(std::vector<Triangle *> &TriangleList)
+{
 
     float f1 = (50 - 0.1) / 2.0;
     float f2 = (50 + 0.1) / 2.0;
 
-    Eigen::Matrix4f mvp = projection * view * model;
-    for (const auto& t:TriangleList)
-    {
-        Triangle newtri = *t;
-
-        std::array<Eigen::Vector4f, 3> mm {
-                (view * model * t->v[0]),
-                (view * model * t->v[1]),
-                (view * model * t->v[2])
-        };
-
-        std::array<Eigen::Vector3f, 3> viewspace_pos;
-
-        std::transform(mm.begin(), mm.end(), viewspace_pos.begin(), [](auto& v) {
-            return v.template head<3>();
-        });
-
-        Eigen::Vector4f v[] = {
-                mvp * t->v[0],
-                mvp * t->v[1],
-                mvp * t->v[2]
-        };
-        //Homogeneous division
-        for (auto& vec : v) {
-            vec.x()/=vec.w();
-            vec.y()/=vec.w();
-            vec.z()/=vec.w();
-        }
+    Eigen::Matrix4f mv = view * model;
+    Eigen::Matrix4f mvp = projection * mv;
+    Eigen::Matrix4f inv_trans = mv.inverse().transpose();
 
-        Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
-        Eigen::Vector4f n[] = {
-                inv_trans * to_vec4(t->normal[0], 0.0f),
-                inv_trans * to_vec4(t->normal[1], 0.0f),
-                inv_trans * to_vec4(t->normal[2], 0.0f)
-        };
+    const int count = (int)TriangleList.size();
+    screen_triangles.resize(count);
+    view_positions.resize(count);
 
-        //Viewport transformation
-        for (auto & vert : v)
-        {
-            vert.x() = 0.5*width*(vert.x()+1.0);
-            vert.y() = 0.5*height*(vert.y()+1.0);
-            vert.z() = vert.z() * f1 + f2;
-        }
+    int threads = num_threads > 0 ? num_threads : (int)std::thread::hardware_concurrency();
+    threads = std::max(threads, 1);
 
-        for (int i = 0; i < 3; ++i)
-        {
-            //screen space coordinates
-            newtri.setVertex(i, v[i]);
-        }
+    if (deferred && gbuffer.covered.size() != frame_buf.size())
+        gbuffer.resize(frame_buf.size());
 
-        for (int i = 0; i < 3; ++i)
+    // Vertex stage, the threads take chunks of triangles
+    const int chunk = 256;
+    std::atomic<int> next_chunk{0};
+    run_parallel(std::min(threads, (count + chunk - 1) / chunk), [&] {
+        for (int begin; (begin = chunk * next_chunk++) < count;)
         {
-            //view space normal
-            newtri.setNormal(i, n[i].head<3>());
-        }
+            for (int i = begin; i < std::min(begin + chunk, count); ++i)
+            {
+                const Triangle* t = TriangleList[i];
+                Triangle& newtri = screen_triangles[i];
+                newtri = *t;
+
+                std::array<Eigen::Vector4f, 3> mm {
+                        (mv * t->v[0]),
+                        (mv * t->v[1]),
+                        (mv * t->v[2])
+                };
+
+                std::transform(mm.begin(), mm.end(), view_positions[i].begin(), [](auto& v) {
+                    return v.template head<3>();
+                });
+
+                Eigen::Vector4f v[] = {
+                        mvp * t->v[0],
+                        mvp * t->v[1],
+                        mvp * t->v[2]
+                };
+                //Homogeneous division
+                for (auto& vec : v) {
+                    vec.x()/=vec.w();
+                    vec.y()/=vec.w();
+                    vec.z()/=vec.w();
+                }
 
-        newtri.setColor(0, 148,121.0,92.0);
-        newtri.setColor(1, 148,121.0,92.0);
-        newtri.setColor(2, 148,121.0,92.0);
+                Eigen::Vector4f n[] = {
+                        inv_trans * to_vec4(t->normal[0], 0.0f),
+                        inv_trans * to_vec4(t->normal[1], 0.0f),
+                        inv_trans * to_vec4(t->normal[2], 0.0f)
+                };
 
-        // Also pass view space vertice position
-        rasterize_triangle(newtri, viewspace_pos);
-    }
-}
+                //Viewport transformation
+                for (auto & vert : v)
+                {
+                    vert.x() = 0.5*width*(vert.x()+1.0);
+                    vert.y() = 0.5*height*(vert.y()+1.0);
+                    vert.z() = vert.z() * f1 + f2;
+                }
 
-static Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
-{
-    return (alpha * vert1 + beta * vert2 + gamma * vert3) / weight;
-}
+                for (int j = 0; j < 3; ++j)
+                {
+                    //screen space coordinates
+                    newtri.setVertex(j, v[j]);
+                }
 
-static Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const Eigen::Vector2f& vert1, const Eigen::Vector2f& vert2, const Eigen::Vector2f& vert3, float weight)
-{
-    auto u = (alpha * vert1[0] + beta * vert2[0] + gamma * vert3[0]);
-    auto v = (alpha * vert1[1] + beta * vert2[1] + gamma * vert3[1]);
+                for (int j = 0; j < 3; ++j)
+                {
+                    //view space normal
+                    newtri.setNormal(j, n[j].head<3>());
+                }
+
+                newtri.setColor(0, 148,121.0,92.0);
+                newtri.setColor(1, 148,121.0,92.0);
+                newtri.setColor(2, 148,121.0,92.0);
+            }
+        }
+    });
 
-    u /= weight;
-    v /= weight;
+    bin_triangles();
 
-    return Eigen::Vector2f(u, v);
+    return threads;
 }
 
-//Screen space rasterization
-void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos) 
+// Appends every screen triangle to the tiles its bounding box overlaps
+void rst::rasterizer::bin_triangles()
 {
-    // From your HW3, get the triangle rasterization code.
-    auto v = t.toVector4();
-
-    // Find out the bounding box of current triangle.
-    // ΪδΧ
-    float xMin, xMax, yMin, yMax;
-    // ʼΪp0
-    xMin = v[0].x();
-    xMax = v[0].x();
-    yMin = v[0].y();
-    yMax = v[0].y();
-    for (int j = 1; j < 3; j++) {
-        if (xMin > v[j].x()) {
-            xMin = v[j].x();
-        }
-        if (xMax < v[j].x()) {
-            xMax = v[j].x();
-        }
-        if (yMin > v[j].y()) {
-            yMin = v[j].y();
-        }
-        if (yMax < v[j].y()) {
-            yMax = v[j].y();
-        }
-    }
-    // Inside your rasterization loop:
-    for (int x = xMin; x < xMax; x++) {
-        for (int y = yMin; y < yMax; y++) {
-            // If so, use the following code to get the interpolated z value.
-            //صϽ+0.5
-            if (insideTriangle(x + 0.5, y + 0.5, t.v)) {
-                //    * v[i].w() is the vertex view space depth value z.
-                //    * Z is interpolated view space depth for the current pixel
-                //    * zp is depth between zNear and zFar, used for z-buffer
-                auto [alpha, beta, gamma] = computeBarycentric2D(x, y, t.v);
-                float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-                float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-                zp *= Z;
-                // Interpolate the attributes:
-                auto interpolated_color = interpolate(alpha, beta, gamma, t.color[0], t.color[1], t.color[2], 1);
-                auto interpolated_normal = interpolate(alpha, beta, gamma, t.normal[0], t.normal[1], t.normal[2], 1);
-                auto interpolated_texcoords = interpolate(alpha, beta, gamma, t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1);
-                // shadingcoords: camera spaceλãΪrl
-                auto interpolated_shadingcoords = interpolate(alpha, beta, gamma, view_pos[0], view_pos[1], view_pos[2], 1);
-                fragment_shader_payload payload(interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
-                payload.view_pos = interpolated_shadingcoords;
-                auto pixel_color = fragment_shader(payload);
-                int index = get_index(x, y);
-                float depthBufferZ = depth_buf[index];
-                // ȻԽ۲ԽԶ
-                if (zp < depthBufferZ) {
-                    Eigen::Vector2i nPoint(x, y);
-                    set_pixel(nPoint, pixel_color);
-                    depth_buf[index] = zp; 
-                }
+    // get_index maps the pixel rows 1 to height into the buffers, the tiles
+    // cover those rows and the columns 0 to width - 1
+    const int columns = (width + tile_size - 1) / tile_size;
+    const int rows = (height + tile_size - 1) / tile_size;
+    if (tiles.empty())
+    {
+        for (int ty = 0; ty < rows; ++ty)
+        {
+            for (int tx = 0; tx < columns; ++tx)
+            {
+                Tile tile;
+                tile.x0 = tx * tile_size;
+                tile.y0 = 1 + ty * tile_size;
+                tile.x1 = std::min(width, tile.x0 + tile_size);
+                tile.y1 = std::min(height + 1, tile.y0 + tile_size);
+                tile.blocks_x = (tile.x1 - tile.x0 + Tile::block - 1) / Tile::block;
+                int blocks_y = (tile.y1 - tile.y0 + Tile::block - 1) / Tile::block;
+                tile.block_depth.resize(tile.blocks_x * blocks_y);
+                for (int by = tile.y0; by < tile.y1; by += Tile::block)
+                    for (int bx = tile.x0; bx < tile.x1; bx += Tile::block)
+                        update_block_depth(tile, bx, by);
+                tiles.push_back(tile);
             }
         }
     }
+    for (auto& tile : tiles)
+        tile.triangles.clear();
+
+    for (int i = 0; i < (int)screen_triangles.size(); ++i)
+    {
+        float xMin, xMax, yMin, yMax;
+        boundingBox(screen_triangles[i].v, xMin, xMax, yMin, yMax);
+        // rasterize_triangle visits (int)xMin <= x < xMax and the same in y;
+        // boxes off the screen, or with NaN corners, have nothing to draw
+        if (!(xMax > 0 && xMin < width && yMax > 1 && yMin < height + 1))
+            continue;
+        int x0 = (int)std::max(xMin, 0.f);
+        int y0 = (int)std::max(yMin, 1.f);
+        int x1 = (int)std::ceil(std::min(xMax, (float)width)) - 1;
+        int y1 = (int)std::ceil(std::min(yMax, (float)height + 1)) - 1;
+        for (int ty = (y0 - 1) / tile_size; ty <= (y1 - 1) / tile_size; ++ty)
+            for (int tx = x0 / tile_size; tx <= x1 / tile_size; ++tx)
+                tiles[ty * columns + tx].triangles.push_back(i);
+    }
+}
 
+// Takes the farthest depth of the block from (bx, by) again after pixels of
+// it were drawn, and of the tile
+void rst::rasterizer::update_block_depth(Tile& tile, int bx, int by)
+{
+    float farthest = -std::numeric_limits<float>::infinity();
+    for (int y = by; y < std::min(by + Tile::block, tile.y1); ++y)
+        for (int x = bx; x < std::min(bx + Tile::block, tile.x1); ++x)
+            farthest = std::max(farthest, depth_buf[get_index(x, y)]);
+    tile.block_depth[(by - tile.y0) / Tile::block * tile.blocks_x + (bx - tile.x0) / Tile::block] = farthest;
+    tile.max_depth = *std::max_element(tile.block_depth.begin(), tile.block_depth.end());
 }
 
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
@@ -344,6 +333,11 @@ void rst::rasterizer::clear(rst::Buffers buff)
     if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
     {
         std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        for (auto& tile : tiles)
+        {
+            std::fill(tile.block_depth.begin(), tile.block_depth.end(), std::numeric_limits<float>::infinity());
+            tile.max_depth = std::numeric_limits<float>::infinity();
+        }
     }
 }
 
@@ -355,11 +349,6 @@ rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
     texture = std::nullopt;
 }
 
-int rst::rasterizer::get_index(int x, int y)
-{
-    return (height-y)*width + x;
-}
-
 void rst::rasterizer::set_pixel(const Vector2i &point, const Eigen::Vector3f &color)
 {
     //old index: auto ind = point.y() + point.x() * width;
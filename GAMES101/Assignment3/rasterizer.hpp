@@ -7,9 +7,16 @@
 #include <eigen3/Eigen/Eigen>
 #include <optional>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <functional>
+#include <thread>
+#include <vector>
 #include "global.hpp"
 #include "Shader.hpp"
 #include "Triangle.hpp"
+#include "TriangleSetup.hpp"
 
 using namespace Eigen;
 
@@ -82,12 +89,63 @@ namespace rst
         void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
         void draw(std::vector<Triangle *> &TriangleList);
 
+        // draw(TriangleList) with a fragment shader functor in place of the
+        // std::function of set_fragment_shader. The pixel loop is compiled
+        // for every FragmentShader type with the shader call inlined, e.g.
+        // r.draw(list, [](const fragment_shader_payload& p) { return ...; });
+        template <typename FragmentShader>
+        void draw(std::vector<Triangle *> &TriangleList, const FragmentShader& shader);
+
+        // draw(TriangleList) bins the triangles into tile_size x tile_size
+        // screen tiles and rasterizes the tiles on num_threads threads (0: one
+        // per core). Each tile draws its triangles in submission order, so the
+        // image does not depend on either setting.
+        void set_tile_size(int size)
+        {
+            // the next draw lays out the new tiles, with their coarse depth
+            // taken from depth_buf
+            if (std::max(1, size) != tile_size)
+                tiles.clear();
+            tile_size = std::max(1, size);
+        }
+        void set_num_threads(int n) { num_threads = n; }
+
+        // Deferred shading: draw(TriangleList) first keeps the shader inputs
+        // of the closest fragment of every pixel in a G-buffer, then shades
+        // each pixel it covered once, whatever the overdraw
+        void set_deferred(bool on) { deferred = on; }
+
         std::vector<Eigen::Vector3f>& frame_buffer() { return frame_buf; }
 
     private:
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
-        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos);
+        // A screen region owned by one thread at a time: pixels x0 <= x < x1,
+        // y0 <= y < y1, and the triangles overlapping it in submission order.
+        // The coarse depth buffer holds the farthest depth_buf value of each
+        // block x block pixels from (x0, y0) and max_depth the farthest of the
+        // tile, triangles and blocks behind them are culled without shading.
+        struct Tile
+        {
+            static constexpr int block = 8;
+
+            int x0, y0, x1, y1;
+            std::vector<int> triangles;
+
+            int blocks_x;
+            std::vector<float> block_depth;
+            float max_depth;
+        };
+
+        int vertex_stage(std::vector<Triangle *> &TriangleList);
+        void bin_triangles();
+        template <typename FragmentShader>
+        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos, Tile& tile, const FragmentShader& shader);
+        template <typename FragmentShader>
+        bool draw_pixel(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, int x, int y, const float* weight, float zp, const FragmentShader& shader);
+        template <typename FragmentShader>
+        void shade_tile(const Tile& tile, const FragmentShader& shader);
+        void update_block_depth(Tile& tile, int bx, int by);
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
@@ -110,11 +168,295 @@ namespace rst
 
         std::vector<Eigen::Vector3f> frame_buf;
         std::vector<float> depth_buf;
-        int get_index(int x, int y);
+        int get_index(int x, int y) const { return (height-y)*width + x; }
+
+        int tile_size = 64;
+        int num_threads = 0;
+        std::vector<Tile> tiles;
+
+        // The fragment shader inputs of the deferred pass, one float plane
+        // per input component indexed like frame_buf, so the shading pass
+        // walks a tile row as plain float spans. The normals are stored as
+        // interpolated and normalized there, once per pixel. covered marks
+        // the pixels that the current draw drew and still has to shade.
+        struct GBuffer
+        {
+            enum Plane { color_r, color_g, color_b, normal_x, normal_y, normal_z,
+                         tex_u, tex_v, view_x, view_y, view_z, planes };
+
+            std::vector<float> plane[planes];
+            std::vector<char> covered;
+
+            void resize(size_t size)
+            {
+                for (auto& p : plane)
+                    p.resize(size);
+                covered.assign(size, 0);
+            }
+
+            void store(int index, const Eigen::Vector3f& color, const Eigen::Vector3f& normal,
+                       const Eigen::Vector2f& tex_coords, const Eigen::Vector3f& view_pos)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    plane[color_r + i][index] = color[i];
+                    plane[normal_x + i][index] = normal[i];
+                    plane[view_x + i][index] = view_pos[i];
+                }
+                plane[tex_u][index] = tex_coords[0];
+                plane[tex_v][index] = tex_coords[1];
+                covered[index] = 1;
+            }
+
+            Eigen::Vector3f vector3(Plane first, int index) const
+            {
+                return {plane[first][index], plane[first + 1][index], plane[first + 2][index]};
+            }
+        };
+
+        bool deferred = false;
+        GBuffer gbuffer;
+
+        // draw(TriangleList) output of the vertex stage, screen space
+        // triangles and their view space vertex positions
+        std::vector<Triangle> screen_triangles;
+        std::vector<std::array<Eigen::Vector3f, 3>> view_positions;
 
         int width, height;
 
         int next_id = 0;
         int get_next_id() { return next_id++; }
     };
+
+    // Runs work on the calling thread and threads - 1 more
+    inline void run_parallel(int threads, const std::function<void()>& work)
+    {
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; ++i)
+            workers.emplace_back(work);
+        work();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    inline void boundingBox(const Vector4f* v, float& xMin, float& xMax, float& yMin, float& yMax)
+    {
+        // ʼΪp0
+        xMin = v[0].x();
+        xMax = v[0].x();
+        yMin = v[0].y();
+        yMax = v[0].y();
+        for (int j = 1; j < 3; j++) {
+            if (xMin > v[j].x()) {
+                xMin = v[j].x();
+            }
+            if (xMax < v[j].x()) {
+                xMax = v[j].x();
+            }
+            if (yMin > v[j].y()) {
+                yMin = v[j].y();
+            }
+            if (yMax < v[j].y()) {
+                yMax = v[j].y();
+            }
+        }
+    }
+
+    // Normalizes the n vectors (x[i], y[i], z[i]) in place, four at a time
+    // with SSE when the quads use SIMD, bit for bit like Eigen's normalized().
+    // Zero vectors stay zero.
+    inline void normalize_span(float* x, float* y, float* z, int n)
+    {
+        int i = 0;
+#if defined(RASTERIZER_AVX2) || defined(RASTERIZER_SSE2)
+        const __m128 min_length = _mm_set1_ps(FLT_MIN);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+            __m128 squared = _mm_add_ps(_mm_mul_ps(vx, vx), _mm_add_ps(_mm_mul_ps(vy, vy), _mm_mul_ps(vz, vz)));
+            __m128 length = _mm_max_ps(_mm_sqrt_ps(squared), min_length);
+            _mm_storeu_ps(x + i, _mm_div_ps(vx, length));
+            _mm_storeu_ps(y + i, _mm_div_ps(vy, length));
+            _mm_storeu_ps(z + i, _mm_div_ps(vz, length));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            // summed in the order of Eigen's squaredNorm
+            float length = std::max(std::sqrt(x[i] * x[i] + (y[i] * y[i] + z[i] * z[i])), FLT_MIN);
+            x[i] /= length;
+            y[i] /= length;
+            z[i] /= length;
+        }
+    }
+
+    inline Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
+    {
+        return (alpha * vert1 + beta * vert2 + gamma * vert3) / weight;
+    }
+
+    inline Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const Eigen::Vector2f& vert1, const Eigen::Vector2f& vert2, const Eigen::Vector2f& vert3, float weight)
+    {
+        auto u = (alpha * vert1[0] + beta * vert2[0] + gamma * vert3[0]);
+        auto v = (alpha * vert1[1] + beta * vert2[1] + gamma * vert3[1]);
+
+        u /= weight;
+        v /= weight;
+
+        return Eigen::Vector2f(u, v);
+    }
+
+    template <typename FragmentShader>
+    void rasterizer::draw(std::vector<Triangle *> &TriangleList, const FragmentShader& shader)
+    {
+        int threads = vertex_stage(TriangleList);
+
+        // A tile is drawn by one thread, which owns its pixels in frame_buf and
+        // depth_buf, so the threads need no locks. Triangles go in the order
+        // they were submitted, as the depth test keeps the first of equal depths.
+        std::atomic<int> next_tile{0};
+        run_parallel(std::min(threads, (int)tiles.size()), [&] {
+            for (int i; (i = next_tile++) < (int)tiles.size();)
+            {
+                Tile& tile = tiles[i];
+                for (int index : tile.triangles)
+                {
+                    // Also pass view space vertice position
+                    rasterize_triangle(screen_triangles[index], view_positions[index], tile, shader);
+                }
+                if (deferred)
+                    shade_tile(tile, shader);
+            }
+        });
+    }
+
+    // The shading pass of deferred shading, for the pixels of the tile that
+    // the G-buffer holds a fragment for
+    template <typename FragmentShader>
+    void rasterizer::shade_tile(const Tile& tile, const FragmentShader& shader)
+    {
+        float* nx = gbuffer.plane[GBuffer::normal_x].data();
+        float* ny = gbuffer.plane[GBuffer::normal_y].data();
+        float* nz = gbuffer.plane[GBuffer::normal_z].data();
+        for (int y = tile.y0; y < tile.y1; ++y)
+        {
+            const int begin = get_index(tile.x0, y), end = begin + tile.x1 - tile.x0;
+            normalize_span(nx + begin, ny + begin, nz + begin, end - begin);
+            // The shaders take one pixel at a time
+            for (int index = begin; index < end; ++index)
+            {
+                if (!gbuffer.covered[index])
+                    continue;
+                gbuffer.covered[index] = 0;
+                Eigen::Vector2f tex_coords(gbuffer.plane[GBuffer::tex_u][index], gbuffer.plane[GBuffer::tex_v][index]);
+                fragment_shader_payload payload(gbuffer.vector3(GBuffer::color_r, index), gbuffer.vector3(GBuffer::normal_x, index), tex_coords, texture ? &*texture : nullptr);
+                payload.view_pos = gbuffer.vector3(GBuffer::view_x, index);
+                frame_buf[index] = shader(payload);
+            }
+        }
+    }
+
+    //Screen space rasterization
+    template <typename FragmentShader>
+    void rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, Tile& tile, const FragmentShader& shader)
+    {
+        // The interpolated depth lies between the vertex depths, less a margin
+        // for the rounding of the interpolation. Nothing of a triangle at least
+        // as far as all of a tile or block passes the depth test there.
+        float zmin = std::min({t.v[0].z(), t.v[1].z(), t.v[2].z()});
+        zmin -= 1e-5f * std::max({std::abs(t.v[0].z()), std::abs(t.v[1].z()), std::abs(t.v[2].z())});
+        if (zmin >= tile.max_depth)
+            return;
+
+        // Edge equations and barycentric coordinates are set up once per triangle
+        TriangleSetup setup;
+        if (!setup.setup(t.v))
+            return;
+
+        // Find out the bounding box of current triangle.
+        // ΪδΧ
+        float xMin, xMax, yMin, yMax;
+        boundingBox(t.v, xMin, xMax, yMin, yMax);
+        // only the part of the box in the tile, other threads draw the rest
+        int x0 = std::max((int)std::floor(xMin), tile.x0);
+        int y0 = std::max((int)std::floor(yMin), tile.y0);
+        int x1 = std::min((int)std::ceil(xMax), tile.x1);
+        int y1 = std::min((int)std::ceil(yMax), tile.y1);
+
+        // The blocks of the coarse depth buffer, skipped if all their pixel
+        // centers are outside an edge or behind what the block has drawn; the
+        // others are tested a 2x2 quad at a time
+        const int block = Tile::block;
+        const int first_bx = tile.x0 + (x0 - tile.x0) / block * block;
+        const int first_by = tile.y0 + (y0 - tile.y0) / block * block;
+        for (int by = first_by; by < y1; by += block) {
+            for (int bx = first_bx; bx < x1; bx += block) {
+                int b = (by - tile.y0) / block * tile.blocks_x + (bx - tile.x0) / block;
+                if (zmin >= tile.block_depth[b] || setup.outside(bx, by, block))
+                    continue;
+                int bx1 = std::min(bx + block, x1);
+                int by1 = std::min(by + block, y1);
+                bool drawn = false;
+                for (int y = by; y < by1; y += 2) {
+                    QuadEdges quad(setup, bx, y);
+                    for (int x = bx; x < bx1; x += 2, quad.step()) {
+                        int mask = quad.mask();
+                        // lanes past the end of the block
+                        if (x + 1 == bx1)
+                            mask &= 0b0101;
+                        if (y + 1 == by1)
+                            mask &= 0b0011;
+                        if (!mask)
+                            continue;
+                        int64_t e[4][3];
+                        quad.store(e);
+                        for (int k = 0; k < 4; ++k) {
+                            if (mask >> k & 1) {
+                                float weight[3], zp;
+                                setup.barycentric(e[k], weight, zp);
+                                drawn |= draw_pixel(t, view_pos, x + (k & 1), y + (k >> 1), weight, zp, shader);
+                            }
+                        }
+                    }
+                }
+                if (drawn)
+                    update_block_depth(tile, bx, by);
+            }
+        }
+    }
+
+    // Draws the pixel (x, y) of t if it is closer than the depth buffer, and
+    // tells whether it did; deferred shading keeps the shader inputs for later.
+    // weight are the perspective correct barycentric coordinates of the pixel
+    // center, zp is depth between zNear and zFar.
+    template <typename FragmentShader>
+    bool rasterizer::draw_pixel(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, int x, int y, const float* weight, float zp, const FragmentShader& shader)
+    {
+        // The shaders can not change the depth, so the depth test comes first
+        // and hidden pixels are never shaded
+        int index = get_index(x, y);
+        // ȻԽ۲ԽԶ
+        if (!(zp < depth_buf[index]))
+            return false;
+
+        float alpha = weight[0], beta = weight[1], gamma = weight[2];
+        // Interpolate the attributes:
+        auto interpolated_color = interpolate(alpha, beta, gamma, t.color[0], t.color[1], t.color[2], 1);
+        auto interpolated_normal = interpolate(alpha, beta, gamma, t.normal[0], t.normal[1], t.normal[2], 1);
+        auto interpolated_texcoords = interpolate(alpha, beta, gamma, t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1);
+        // shadingcoords: camera spaceλãΪrl
+        auto interpolated_shadingcoords = interpolate(alpha, beta, gamma, view_pos[0], view_pos[1], view_pos[2], 1);
+        if (deferred) {
+            gbuffer.store(index, interpolated_color, interpolated_normal, interpolated_texcoords, interpolated_shadingcoords);
+            depth_buf[index] = zp;
+            return true;
+        }
+        fragment_shader_payload payload(interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
+        payload.view_pos = interpolated_shadingcoords;
+        auto pixel_color = shader(payload);
+        Eigen::Vector2i nPoint(x, y);
+        set_pixel(nPoint, pixel_color);
+        depth_buf[index] = zp;
+        return true;
+    }
 }
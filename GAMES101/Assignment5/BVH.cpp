@@ -0,0 +1,249 @@
+#include <algorithm>
+#include "BVH.hpp"
+#include "Sphere.hpp"
+
+static float component(const Vector3f& v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static Vector3f inverse(const Vector3f& dir)
+{
+    return Vector3f(1 / dir.x, 1 / dir.y, 1 / dir.z);
+}
+
+BVHAccel::BVHAccel(const std::vector<std::unique_ptr<Object>>& objects, int maxPrimsInNode)
+{
+    if (objects.empty())
+        return;
+    for (const auto& object : objects)
+        prims.push_back(object.get());
+
+    std::vector<int> order(prims.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = (int)i;
+    nodes.reserve(2 * prims.size());
+    build(order, 0, (int)order.size(), std::max(1, maxPrimsInNode));
+
+    std::vector<Object*> ordered;
+    for (int i : order)
+        ordered.push_back(prims[i]);
+    prims.swap(ordered);
+
+    for (LinearNode& node : nodes)
+        if (node.nPrims > 0)
+            batchSpheres(node);
+}
+
+// Moves the spheres of a leaf to its front and copies them into batches
+void BVHAccel::batchSpheres(LinearNode& leaf)
+{
+    Object** first = &prims[leaf.firstPrim];
+    Object** spheresEnd = std::stable_partition(first, first + leaf.nPrims, [](Object* object) {
+        return dynamic_cast<Sphere*>(object) != nullptr;
+    });
+    leaf.nSpheres = (uint16_t)(spheresEnd - first);
+    leaf.firstBatch = (int)sphereBatches.size();
+    for (int i = 0; i < leaf.nSpheres; ++i) {
+        if (i % SphereBatch::width == 0)
+            sphereBatches.emplace_back();
+        auto sphere = static_cast<const Sphere*>(first[i]);
+        sphereBatches.back().append(sphere->center, sphere->radius2);
+    }
+}
+
+void BVHAccel::intersectLeaf(const LinearNode& leaf, const Vector3f& orig, const Vector3f& dir,
+                             float& tNear, std::optional<hit_payload>& payload) const
+{
+    for (int b = 0; b * SphereBatch::width < leaf.nSpheres; ++b) {
+        float tNearK;
+        int lane = sphereBatches[leaf.firstBatch + b].intersect(orig, dir, tNear, tNearK);
+        if (lane >= 0) {
+            payload.emplace();
+            payload->hit_obj = prims[leaf.firstPrim + b * SphereBatch::width + lane];
+            payload->tNear = tNearK;
+            payload->index = 0;
+            payload->uv = Vector2f(0);
+            tNear = tNearK;
+        }
+    }
+    for (int i = leaf.firstPrim + leaf.nSpheres; i < leaf.firstPrim + leaf.nPrims; ++i) {
+        float tNearK = kInfinity;
+        uint32_t indexK;
+        Vector2f uvK;
+        if (prims[i]->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tNear) {
+            payload.emplace();
+            payload->hit_obj = prims[i];
+            payload->tNear = tNearK;
+            payload->index = indexK;
+            payload->uv = uvK;
+            tNear = tNearK;
+        }
+    }
+}
+
+bool BVHAccel::occludedLeaf(const LinearNode& leaf, const Vector3f& orig, const Vector3f& dir,
+                            float tMax) const
+{
+    for (int b = 0; b * SphereBatch::width < leaf.nSpheres; ++b)
+        if (sphereBatches[leaf.firstBatch + b].intersectP(orig, dir, tMax))
+            return true;
+    for (int i = leaf.firstPrim + leaf.nSpheres; i < leaf.firstPrim + leaf.nPrims; ++i) {
+        // meshes only look for hits closer than tnear
+        float tNearK = tMax;
+        uint32_t indexK;
+        Vector2f uvK;
+        if (prims[i]->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tMax)
+            return true;
+    }
+    return false;
+}
+
+// Median split on the axis the centroids spread the most along. Scenes of
+// this assignment have few objects, a cheap split is as good as any.
+int BVHAccel::build(std::vector<int>& order, int start, int end, int maxPrimsInNode)
+{
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+
+    Bounds3 bounds, centroids;
+    for (int i = start; i < end; ++i) {
+        Bounds3 b = prims[order[i]]->getBounds();
+        bounds = Union(bounds, b);
+        centroids = Union(centroids, b.Centroid());
+    }
+    nodes[index].bounds = bounds;
+
+    int axis = centroids.maxExtent();
+    int n = end - start;
+    if (n <= maxPrimsInNode ||
+        component(centroids.pMax, axis) == component(centroids.pMin, axis)) {
+        nodes[index].firstPrim = start;
+        nodes[index].nPrims = (uint16_t)n;
+        return index;
+    }
+
+    int mid = start + n / 2;
+    std::nth_element(&order[start], &order[mid], &order[end - 1] + 1, [&](int a, int b) {
+        return component(prims[a]->getBounds().Centroid(), axis) <
+               component(prims[b]->getBounds().Centroid(), axis);
+    });
+    nodes[index].axis = (uint8_t)axis;
+    nodes[index].nPrims = 0;
+    build(order, start, mid, maxPrimsInNode);
+    nodes[index].secondChild = build(order, mid, end, maxPrimsInNode);
+    return index;
+}
+
+std::optional<hit_payload> BVHAccel::intersect(const Vector3f& orig, const Vector3f& dir) const
+{
+    std::optional<hit_payload> payload;
+    if (nodes.empty())
+        return payload;
+
+    Vector3f invDir = inverse(dir);
+    bool dirIsNeg[3] = {dir.x < 0, dir.y < 0, dir.z < 0};
+    float tNear = kInfinity;
+    int stack[64], top = 0, current = 0;
+    while (true) {
+        const LinearNode& node = nodes[current];
+        if (node.bounds.IntersectP(orig, invDir, tNear)) {
+            if (node.nPrims > 0) {
+                intersectLeaf(node, orig, dir, tNear, payload);
+            }
+            else {
+                // visit the child on the side the ray comes from first
+                if (dirIsNeg[node.axis]) {
+                    stack[top++] = current + 1;
+                    current = node.secondChild;
+                }
+                else {
+                    stack[top++] = node.secondChild;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+    return payload;
+}
+
+bool BVHAccel::occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+{
+    if (nodes.empty())
+        return false;
+
+    Vector3f invDir = inverse(dir);
+    int stack[64], top = 0, current = 0;
+    while (true) {
+        const LinearNode& node = nodes[current];
+        if (node.bounds.IntersectP(orig, invDir, tMax)) {
+            if (node.nPrims > 0) {
+                if (occludedLeaf(node, orig, dir, tMax))
+                    return true;
+            }
+            else {
+                // any hit will do, the order does not matter
+                stack[top++] = node.secondChild;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+    return false;
+}
+
+void BVHAccel::intersect(const RayPacket& packet, std::optional<hit_payload>* hits) const
+{
+    const int n = packet.size;
+    Vector3f invDir[RayPacket::maxSize];
+    float tNear[RayPacket::maxSize];
+    for (int k = 0; k < n; ++k) {
+        hits[k].reset();
+        invDir[k] = inverse(packet.dir[k]);
+        tNear[k] = kInfinity;
+    }
+    if (nodes.empty())
+        return;
+
+    // the rays are coherent, the first one decides the order of the children
+    const Vector3f& dir0 = packet.dir[0];
+    bool dirIsNeg[3] = {dir0.x < 0, dir0.y < 0, dir0.z < 0};
+    int stack[64], top = 0, current = 0;
+    while (true) {
+        const LinearNode& node = nodes[current];
+        // rays of the packet that enter the node before their closest hit
+        uint32_t active = 0;
+        for (int k = 0; k < n; ++k)
+            if (node.bounds.IntersectP(packet.orig, invDir[k], tNear[k]))
+                active |= 1u << k;
+
+        if (active) {
+            if (node.nPrims > 0) {
+                for (int k = 0; k < n; ++k)
+                    if (active & (1u << k))
+                        intersectLeaf(node, packet.orig, packet.dir[k], tNear[k], hits[k]);
+            }
+            else {
+                if (dirIsNeg[node.axis]) {
+                    stack[top++] = current + 1;
+                    current = node.secondChild;
+                }
+                else {
+                    stack[top++] = node.secondChild;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+#include "Bounds3.hpp"
+#include "Object.hpp"
+#include "SphereBatch.hpp"
+
+struct hit_payload
+{
+    float tNear;
+    uint32_t index;
+    Vector2f uv;
+    Object* hit_obj;
+};
+
+// Rays that start at the same point and point roughly the same way, the
+// primary rays of a block of pixels. They are traced together: a node is
+// fetched and tested once for the whole packet and entered if any of its
+// rays can still hit something in it.
+struct RayPacket
+{
+    static constexpr int maxSize = 16;
+
+    Vector3f orig;
+    Vector3f dir[maxSize];
+    int size = 0;
+};
+
+// Bounding volume hierarchy over the objects of a scene, replacing the scan
+// of every object for every ray. Meshes are leaves of their own, the
+// hierarchy only sorts whole objects. The spheres of a leaf are copied into
+// SphereBatches and tested together without a virtual call.
+class BVHAccel
+{
+public:
+    // The objects stay owned by the scene. Leaves of 16 spheres, a few
+    // batches, trace a few thousand spheres faster than smaller leaves do.
+    explicit BVHAccel(const std::vector<std::unique_ptr<Object>>& objects,
+                      int maxPrimsInNode = 16);
+
+    // closest hit along orig + t * dir, t > 0
+    std::optional<hit_payload> intersect(const Vector3f& orig, const Vector3f& dir) const;
+    // whether anything is hit with 0 < t < tMax, returns at the first hit
+    bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const;
+    // closest hit of every ray of the packet, hits[k] belongs to dir[k]
+    void intersect(const RayPacket& packet, std::optional<hit_payload>* hits) const;
+
+private:
+    // Depth first order: the first child follows its parent, the second is
+    // at secondChild. Leaves list nPrims objects from firstPrim on, the
+    // first nSpheres of them are spheres, also found in the batches from
+    // firstBatch on.
+    struct LinearNode
+    {
+        Bounds3 bounds;
+        union
+        {
+            int firstPrim;
+            int secondChild;
+        };
+        int firstBatch;
+        uint16_t nPrims;
+        uint16_t nSpheres;
+        uint8_t axis;
+    };
+
+    int build(std::vector<int>& order, int start, int end, int maxPrimsInNode);
+    void batchSpheres(LinearNode& leaf);
+    void intersectLeaf(const LinearNode& leaf, const Vector3f& orig, const Vector3f& dir,
+                       float& tNear, std::optional<hit_payload>& payload) const;
+    bool occludedLeaf(const LinearNode& leaf, const Vector3f& orig, const Vector3f& dir,
+                      float tMax) const;
+
+    std::vector<Object*> prims;
+    std::vector<LinearNode> nodes;
+    std::vector<SphereBatch> sphereBatches;
+};
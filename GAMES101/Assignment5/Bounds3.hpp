@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include "Vector.hpp"
+
+// Axis aligned box, the bounds of an object or of a BVH node
+class Bounds3
+{
+public:
+    // an empty box, the union with anything is that thing
+    Bounds3()
+        : pMin(std::numeric_limits<float>::max())
+        , pMax(std::numeric_limits<float>::lowest())
+    {}
+    explicit Bounds3(const Vector3f& p)
+        : pMin(p)
+        , pMax(p)
+    {}
+    Bounds3(const Vector3f& p1, const Vector3f& p2)
+        : pMin(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z))
+        , pMax(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z))
+    {}
+
+    Vector3f Centroid() const { return 0.5f * pMin + 0.5f * pMax; }
+
+    int maxExtent() const
+    {
+        Vector3f d = pMax - pMin;
+        if (d.x > d.y && d.x > d.z)
+            return 0;
+        return d.y > d.z ? 1 : 2;
+    }
+
+    // Slab test of the ray orig + t * dir against the box, a hit is an
+    // overlap of the box with t in [0, tMax]. invDir is 1 / dir.
+    bool IntersectP(const Vector3f& orig, const Vector3f& invDir, float tMax) const
+    {
+        float tx0 = (pMin.x - orig.x) * invDir.x, tx1 = (pMax.x - orig.x) * invDir.x;
+        float ty0 = (pMin.y - orig.y) * invDir.y, ty1 = (pMax.y - orig.y) * invDir.y;
+        float tz0 = (pMin.z - orig.z) * invDir.z, tz1 = (pMax.z - orig.z) * invDir.z;
+        float tEnter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)),
+                                std::max(std::min(tz0, tz1), 0.f));
+        float tExit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)),
+                               std::min(std::max(tz0, tz1), tMax));
+        return tEnter <= tExit;
+    }
+
+    Vector3f pMin, pMax;
+};
+
+inline Bounds3 Union(const Bounds3& a, const Bounds3& b)
+{
+    Bounds3 r;
+    r.pMin = Vector3f(std::min(a.pMin.x, b.pMin.x), std::min(a.pMin.y, b.pMin.y),
+                      std::min(a.pMin.z, b.pMin.z));
+    r.pMax = Vector3f(std::max(a.pMax.x, b.pMax.x), std::max(a.pMax.y, b.pMax.y),
+                      std::max(a.pMax.z, b.pMax.z));
+    return r;
+}
+
+inline Bounds3 Union(const Bounds3& b, const Vector3f& p)
+{
+    return Union(b, Bounds3(p));
+}
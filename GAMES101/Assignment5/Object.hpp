@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Bounds3.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
 
@@ -22,6 +23,8 @@ public:
     virtual void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&, Vector3f&,
                                       Vector2f&) const = 0;
 
+    virtual Bounds3 getBounds() const = 0;
+
     virtual Vector3f evalDiffuseColor(const Vector2f&) const
     {
         return diffuseColor;
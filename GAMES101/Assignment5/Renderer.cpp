@@ -2,7 +2,11 @@
 #include "Vector.hpp"
 #include "Renderer.hpp"
 #include "Scene.hpp"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <optional>
+#include <thread>
 
 inline float deg2rad(const float &deg)
 { return deg * M_PI/180.0; }
@@ -68,43 +72,6 @@ float fresnel(const Vector3f &I, const Vector3f &N, const float &ior)
     // kt = 1 - kr;
 }
 
-// [comment]
-// Returns true if the ray intersects an object, false otherwise.
-//
-// \param orig is the ray origin
-// \param dir is the ray direction
-// \param objects is the list of objects the scene contains
-// \param[out] tNear contains the distance to the cloesest intersected object.
-// \param[out] index stores the index of the intersect triangle if the interesected object is a mesh.
-// \param[out] uv stores the u and v barycentric coordinates of the intersected point
-// \param[out] *hitObject stores the pointer to the intersected object (used to retrieve material information, etc.)
-// \param isShadowRay is it a shadow ray. We can return from the function sooner as soon as we have found a hit.
-// [/comment]
-std::optional<hit_payload> trace(
-        const Vector3f &orig, const Vector3f &dir,
-        const std::vector<std::unique_ptr<Object> > &objects)
-{
-    float tNear = kInfinity;
-    std::optional<hit_payload> payload;
-    for (const auto & object : objects)
-    {
-        float tNearK = kInfinity;
-        uint32_t indexK;
-        Vector2f uvK;
-        if (object->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tNear)
-        {
-            payload.emplace();
-            payload->hit_obj = object.get();
-            payload->tNear = tNearK;
-            payload->index = indexK;
-            payload->uv = uvK;
-            tNear = tNearK;
-        }
-    }
-
-    return payload;
-}
-
 // [comment]
 // Implementation of the Whitted-style light transport algorithm (E [S*] (D|G) L)
 //
@@ -123,14 +90,17 @@ std::optional<hit_payload> trace(
 // [/comment]
 Vector3f castRay(
         const Vector3f &orig, const Vector3f &dir, const Scene& scene,
+        int depth);
+
+// Color seen along orig + t * dir given its closest hit, which primary rays
+// get from a packet and every other ray from castRay
+Vector3f shade(
+        const Vector3f &orig, const Vector3f &dir,
+        const std::optional<hit_payload> &payload, const Scene& scene,
         int depth)
 {
-    if (depth > scene.maxDepth) {
-        return Vector3f(0.0,0.0,0.0);
-    }
-
     Vector3f hitColor = scene.backgroundColor;
-    if (auto payload = trace(orig, dir, scene.get_objects()); payload)
+    if (payload)
     {
         Vector3f hitPoint = orig + dir * payload->tNear;
         Vector3f N; // normal
@@ -183,9 +153,8 @@ Vector3f castRay(
                     float lightDistance2 = dotProduct(lightDir, lightDir);
                     lightDir = normalize(lightDir);
                     float LdotN = std::max(0.f, dotProduct(lightDir, N));
-                    // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                    auto shadow_res = trace(shadowPointOrig, lightDir, scene.get_objects());
-                    bool inShadow = shadow_res && (shadow_res->tNear * shadow_res->tNear < lightDistance2);
+                    // is the point in shadow, is there any object between it and the light?
+                    bool inShadow = scene.occluded(shadowPointOrig, lightDir, std::sqrt(lightDistance2));
 
                     lightAmt += inShadow ? 0 : light->intensity * LdotN;
                     Vector3f reflectionDirection = reflect(-lightDir, N);
@@ -203,6 +172,17 @@ Vector3f castRay(
     return hitColor;
 }
 
+Vector3f castRay(
+        const Vector3f &orig, const Vector3f &dir, const Scene& scene,
+        int depth)
+{
+    if (depth > scene.maxDepth) {
+        return Vector3f(0.0,0.0,0.0);
+    }
+
+    return shade(orig, dir, scene.intersect(orig, dir), scene, depth);
+}
+
 // [comment]
 // The main render function. This where we iterate over all pixels in the image, generate
 // primary rays and cast these rays into the scene. The content of the framebuffer is
@@ -220,24 +200,56 @@ void Renderer::Render(const Scene& scene)
 
     // Use this variable as the eye position to start your rays.
     Vector3f eye_pos(0);
-    int m = 0;
-    for (int j = 0; j < scene.height; ++j)
-    {
-        for (int i = 0; i < scene.width; ++i)
+
+    // The image is cut into bands of packetSize rows that the workers take
+    // in turn. Each band is traced in packets of packetSize x packetSize
+    // primary rays, the packets at the right and bottom edge are cut short.
+    int size = std::clamp(packetSize, 1, 4);
+    int numBands = (scene.height + size - 1) / size;
+    std::atomic<int> nextBand{0};
+    std::mutex progressLock;
+    int bandsDone = 0;
+
+    auto worker = [&]() {
+        RayPacket packet;
+        packet.orig = eye_pos;
+        int pixel[RayPacket::maxSize];
+        std::optional<hit_payload> hits[RayPacket::maxSize];
+        for (int band = nextBand++; band < numBands; band = nextBand++)
         {
-            // generate primary ray direction
-            float x = (2 * ((float)i + 0.5) / scene.width - 1) * imageAspectRatio * scale;
-            float y = (1.0 - 2 * ((float)j + 0.5) / scene.height) * scale;
-            // TODO: Find the x and y positions of the current pixel to get the direction
-            // vector that passes through it.
-            // Also, don't forget to multiply both of them with the variable *scale*, and
-            // x (horizontal) variable with the *imageAspectRatio*     
-
-            Vector3f dir = normalize(Vector3f(x, y, -1)); // Don't forget to normalize this direction!
-            framebuffer[m++] = castRay(eye_pos, dir, scene, 0);
+            int y0 = band * size, y1 = std::min(y0 + size, scene.height);
+            for (int x0 = 0; x0 < scene.width; x0 += size)
+            {
+                int x1 = std::min(x0 + size, scene.width);
+                packet.size = 0;
+                for (int j = y0; j < y1; ++j)
+                {
+                    for (int i = x0; i < x1; ++i)
+                    {
+                        // generate primary ray direction
+                        float x = (2 * ((float)i + 0.5) / scene.width - 1) * imageAspectRatio * scale;
+                        float y = (1.0 - 2 * ((float)j + 0.5) / scene.height) * scale;
+                        pixel[packet.size] = j * scene.width + i;
+                        packet.dir[packet.size++] = normalize(Vector3f(x, y, -1));
+                    }
+                }
+                scene.intersect(packet, hits);
+                for (int k = 0; k < packet.size; ++k)
+                    framebuffer[pixel[k]] = shade(eye_pos, packet.dir[k], hits[k], scene, 0);
+            }
+            std::lock_guard<std::mutex> lock(progressLock);
+            UpdateProgress(++bandsDone / (float)numBands);
         }
-        UpdateProgress(j / (float)scene.height);
-    }
+    };
+
+    int threadCount = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+    std::vector<std::thread> workers;
+    for (int t = 1; t < std::max(1, threadCount); ++t)
+        workers.emplace_back(worker);
+    worker();
+    for (auto& w : workers)
+        w.join();
+    std::cout << std::endl;
 
     // save framebuffer to file
     FILE* fp = fopen("binary.ppm", "wb");
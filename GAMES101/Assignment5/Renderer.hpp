@@ -1,17 +1,15 @@
 #pragma once
 #include "Scene.hpp"
 
-struct hit_payload
-{
-    float tNear;
-    uint32_t index;
-    Vector2f uv;
-    Object* hit_obj;
-};
-
 class Renderer
 {
 public:
+    // number of worker threads, 0 picks std::thread::hardware_concurrency()
+    int numThreads = 0;
+    // primary rays are traced in packets of packetSize x packetSize pixels,
+    // 1 traces them one by one
+    int packetSize = 2;
+
     void Render(const Scene& scene);
 
 private:
@@ -3,3 +3,8 @@
 //
 
 #include "Scene.hpp"
+
+void Scene::buildBVH()
+{
+    bvh = std::make_unique<BVHAccel>(objects);
+}
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <cassert>
 #include <vector>
 #include <memory>
 #include "Vector.hpp"
 #include "Object.hpp"
+#include "BVH.hpp"
 #include "Light.hpp"
 
 class Scene
@@ -26,8 +28,28 @@ public:
     [[nodiscard]] const std::vector<std::unique_ptr<Object> >& get_objects() const { return objects; }
     [[nodiscard]] const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
 
+    // builds the BVH over the objects added so far, call it before rendering
+    void buildBVH();
+
+    [[nodiscard]] std::optional<hit_payload> intersect(const Vector3f& orig, const Vector3f& dir) const
+    {
+        assert(bvh && "Scene::buildBVH() has to be called before tracing rays");
+        return bvh->intersect(orig, dir);
+    }
+    [[nodiscard]] bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+    {
+        assert(bvh && "Scene::buildBVH() has to be called before tracing rays");
+        return bvh->occluded(orig, dir, tMax);
+    }
+    void intersect(const RayPacket& packet, std::optional<hit_payload>* hits) const
+    {
+        assert(bvh && "Scene::buildBVH() has to be called before tracing rays");
+        bvh->intersect(packet, hits);
+    }
+
 private:
     // creating the scene (adding objects and lights)
     std::vector<std::unique_ptr<Object> > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    std::unique_ptr<BVHAccel> bvh;
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+// Thin wrappers over the SSE/AVX intrinsics used by the sphere and triangle
+// batches.
+
+// The vector width is picked at compile time: 8 lanes with AVX, 4 with SSE.
+// Without either, or when RAYTRACING_NO_SIMD is defined, SIMD_WIDTH is 4 and
+// the callers fall back to plain loops over the lanes.
+#if !defined(RAYTRACING_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#define SIMD_WIDTH 8
+#elif !defined(RAYTRACING_NO_SIMD) &&                                         \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SIMD_SSE
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 4
+#endif
+
+namespace simd {
+#if defined(SIMD_AVX)
+typedef __m256 vfloat;
+inline vfloat load(const float* p) { return _mm256_load_ps(p); }
+inline void store(float* p, vfloat a) { _mm256_store_ps(p, a); }
+inline vfloat set1(float f) { return _mm256_set1_ps(f); }
+inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat mask_and(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+// lanes of a where mask is set, of b elsewhere
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline vfloat gt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline vfloat ge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline vfloat le(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline vfloat lt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline int movemask(vfloat a) { return _mm256_movemask_ps(a); }
+#elif defined(SIMD_SSE)
+typedef __m128 vfloat;
+inline vfloat load(const float* p) { return _mm_load_ps(p); }
+inline void store(float* p, vfloat a) { _mm_store_ps(p, a); }
+inline vfloat set1(float f) { return _mm_set1_ps(f); }
+inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat mask_and(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+// lanes of a where mask is set, of b elsewhere
+inline vfloat select(vfloat mask, vfloat a, vfloat b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+inline vfloat gt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+inline vfloat ge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+inline vfloat le(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+inline vfloat lt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline int movemask(vfloat a) { return _mm_movemask_ps(a); }
+#endif
+} // namespace simd
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Simd.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+
+// Up to width spheres stored as centers and squared radii, one array per
+// component, so that one ray is tested against all of them in a single
+// pass. Lanes from count on are unused and never report a hit.
+struct alignas(32) SphereBatch
+{
+    static constexpr int width = SIMD_WIDTH;
+
+    float center[3][width] = {};
+    float radius2[width] = {};
+    int count = 0;
+
+    void append(const Vector3f& c, float r2)
+    {
+        center[0][count] = c.x, center[1][count] = c.y, center[2][count] = c.z;
+        radius2[count] = r2;
+        ++count;
+    }
+
+    // Closest lane hit at 0 <= t < tMax, -1 if there is none. Like
+    // Sphere::intersect, t is the far root when the ray starts inside. Of
+    // lanes hit at the same t the first one is taken.
+    int intersect(const Vector3f& orig, const Vector3f& dir, float tMax, float& tHit) const
+    {
+        alignas(32) float t[width];
+        int mask = hitMask(orig, dir, tMax, t);
+        int lane = -1;
+        for (int i = 0; i < width; ++i)
+            if ((mask >> i & 1) && (lane < 0 || t[i] < t[lane]))
+                lane = i;
+        if (lane >= 0)
+            tHit = t[lane];
+        return lane;
+    }
+
+    bool intersectP(const Vector3f& orig, const Vector3f& dir, float tMax) const
+    {
+        alignas(32) float t[width];
+        return hitMask(orig, dir, tMax, t) != 0;
+    }
+
+private:
+    // bit i is set when lane i is hit at t[i] < tMax
+    int hitMask(const Vector3f& orig, const Vector3f& dir, float tMax, float* t) const;
+};
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+// q = -0.5 * (b + sign(b) * sqrt(discr)) of solveQuadratic. It is evaluated
+// in double there, so it is here too: the roots come out the same to the
+// bit and so do the images.
+inline simd::vfloat quadraticQ(simd::vfloat b, simd::vfloat discr)
+{
+#if defined(SIMD_AVX)
+    __m256d half = _mm256_set1_pd(-0.5), zero = _mm256_setzero_pd();
+    auto q = [&](__m128 b4, __m128 discr4) {
+        __m256d bd = _mm256_cvtps_pd(b4);
+        __m256d root = _mm256_sqrt_pd(_mm256_cvtps_pd(discr4));
+        __m256d positive = _mm256_cmp_pd(bd, zero, _CMP_GT_OQ);
+        __m256d sum = _mm256_blendv_pd(_mm256_sub_pd(bd, root), _mm256_add_pd(bd, root), positive);
+        return _mm256_cvtpd_ps(_mm256_mul_pd(half, sum));
+    };
+    __m128 lo = q(_mm256_castps256_ps128(b), _mm256_castps256_ps128(discr));
+    __m128 hi = q(_mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(discr, 1));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+#else
+    __m128d half = _mm_set1_pd(-0.5), zero = _mm_setzero_pd();
+    auto q = [&](__m128 b2, __m128 discr2) {
+        __m128d bd = _mm_cvtps_pd(b2);
+        __m128d root = _mm_sqrt_pd(_mm_cvtps_pd(discr2));
+        __m128d positive = _mm_cmpgt_pd(bd, zero);
+        __m128d sum = _mm_or_pd(_mm_and_pd(positive, _mm_add_pd(bd, root)),
+                                _mm_andnot_pd(positive, _mm_sub_pd(bd, root)));
+        return _mm_cvtpd_ps(_mm_mul_pd(half, sum));
+    };
+    return _mm_movelh_ps(q(b, discr), q(_mm_movehl_ps(b, b), _mm_movehl_ps(discr, discr)));
+#endif
+}
+
+inline int SphereBatch::hitMask(const Vector3f& orig, const Vector3f& dir, float tMax,
+                                float* t) const
+{
+    using namespace simd;
+    const vfloat dx = set1(dir.x), dy = set1(dir.y), dz = set1(dir.z);
+    vfloat lx = sub(set1(orig.x), load(center[0]));
+    vfloat ly = sub(set1(orig.y), load(center[1]));
+    vfloat lz = sub(set1(orig.z), load(center[2]));
+
+    const vfloat zero = set1(0.f);
+    vfloat a = set1(dotProduct(dir, dir));
+    vfloat b = mul(set1(2.f), add(add(mul(dx, lx), mul(dy, ly)), mul(dz, lz)));
+    vfloat c = sub(add(add(mul(lx, lx), mul(ly, ly)), mul(lz, lz)), load(radius2));
+    vfloat discr = sub(mul(b, b), mul(mul(set1(4.f), a), c));
+    vfloat hit = ge(discr, zero);
+
+    // q keeps the sign of -b, no cancellation in either root
+    vfloat q = quadraticQ(b, max(discr, zero));
+    vfloat x0 = div(q, a), x1 = div(c, q);
+    vfloat tNear = min(x0, x1), tFar = max(x0, x1);
+    vfloat tt = select(lt(tNear, zero), tFar, tNear);
+
+    hit = mask_and(hit, mask_and(ge(tt, zero), lt(tt, set1(tMax))));
+    store(t, tt);
+    return movemask(hit) & ((1 << count) - 1);
+}
+#else
+inline int SphereBatch::hitMask(const Vector3f& orig, const Vector3f& dir, float tMax,
+                                float* t) const
+{
+    int mask = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Vector3f L = orig - Vector3f(center[0][i], center[1][i], center[2][i]);
+        float a = dotProduct(dir, dir);
+        float b = 2 * dotProduct(dir, L);
+        float c = dotProduct(L, L) - radius2[i];
+        float t0, t1;
+        if (!solveQuadratic(a, b, c, t0, t1))
+            continue;
+        t[i] = t0 < 0 ? t1 : t0;
+        if (t[i] >= 0 && t[i] < tMax)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+#endif
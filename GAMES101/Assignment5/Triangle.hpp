@@ -1,8 +1,10 @@
 #pragma once
 
 #include "Object.hpp"
+#include "TriangleBatch.hpp"
 
 #include <cstring>
+#include <vector>
 
 bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, const Vector3f& orig,
                           const Vector3f& dir, float& tnear, float& u, float& v)
@@ -48,24 +50,31 @@ public:
         numTriangles = numTris;
         stCoordinates = std::unique_ptr<Vector2f[]>(new Vector2f[maxIndex]);
         memcpy(stCoordinates.get(), st, sizeof(Vector2f) * maxIndex);
+        for (uint32_t i = 0; i < maxIndex; ++i)
+            bounds = Union(bounds, vertices[i]);
+
+        // triangle k is lane k % width of batch k / width
+        batches.resize((numTris + TriangleBatch::width - 1) / TriangleBatch::width);
+        for (uint32_t k = 0; k < numTris; ++k)
+            batches[k / TriangleBatch::width].append(vertices[vertexIndex[k * 3]],
+                                                  vertices[vertexIndex[k * 3 + 1]],
+                                                  vertices[vertexIndex[k * 3 + 2]]);
     }
 
     bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t& index,
                    Vector2f& uv) const override
     {
         bool intersect = false;
-        for (uint32_t k = 0; k < numTriangles; ++k)
+        for (size_t b = 0; b < batches.size(); ++b)
         {
-            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
-            const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
-            const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
             float t, u, v;
-            if (rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) && t < tnear)
+            int lane = batches[b].intersect(orig, dir, tnear, t, u, v);
+            if (lane >= 0)
             {
                 tnear = t;
                 uv.x = u;
                 uv.y = v;
-                index = k;
+                index = (uint32_t)(b * TriangleBatch::width + lane);
                 intersect |= true;
             }
         }
@@ -88,6 +97,8 @@ public:
         st = st0 * (1 - uv.x - uv.y) + st1 * uv.x + st2 * uv.y;
     }
 
+    Bounds3 getBounds() const override { return bounds; }
+
     Vector3f evalDiffuseColor(const Vector2f& st) const override
     {
         float scale = 5;
@@ -99,4 +110,7 @@ public:
     uint32_t numTriangles;
     std::unique_ptr<uint32_t[]> vertexIndex;
     std::unique_ptr<Vector2f[]> stCoordinates;
+    Bounds3 bounds;
+    // the triangles again, as intersected
+    std::vector<TriangleBatch> batches;
 };
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Simd.hpp"
+#include "Vector.hpp"
+
+// Up to width triangles stored as v0 and the two edges, one array per
+// component, so that one ray is tested against all of them in a single
+// pass. Lanes from count on are unused and never report a hit.
+struct alignas(32) TriangleBatch
+{
+    static constexpr int width = SIMD_WIDTH;
+
+    float v0[3][width] = {};
+    float e1[3][width] = {};
+    float e2[3][width] = {};
+    int count = 0;
+
+    void append(const Vector3f& p0, const Vector3f& p1, const Vector3f& p2)
+    {
+        const Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
+        v0[0][count] = p0.x, v0[1][count] = p0.y, v0[2][count] = p0.z;
+        e1[0][count] = edge1.x, e1[1][count] = edge1.y, e1[2][count] = edge1.z;
+        e2[0][count] = edge2.x, e2[1][count] = edge2.y, e2[2][count] = edge2.z;
+        ++count;
+    }
+
+    // Closest lane hit at 0 < t < tMax, -1 if there is none. On a hit tHit,
+    // u and v are set as rayTriangleIntersect sets tnear, u and v; of lanes
+    // hit at the same t the first one is taken.
+    int intersect(const Vector3f& orig, const Vector3f& dir, float tMax, float& tHit, float& u,
+                  float& v) const
+    {
+        alignas(32) float t[width], b1[width], b2[width];
+        int mask = hitMask(orig, dir, tMax, t, b1, b2);
+        int lane = -1;
+        for (int i = 0; i < width; ++i)
+            if ((mask >> i & 1) && (lane < 0 || t[i] < t[lane]))
+                lane = i;
+        if (lane >= 0)
+        {
+            tHit = t[lane];
+            u = b1[lane];
+            v = b2[lane];
+        }
+        return lane;
+    }
+
+private:
+    // Moller-Trumbore with the same operations in the same order as
+    // rayTriangleIntersect, both faces count. Bit i is set when lane i is
+    // hit at t[i] < tMax.
+    int hitMask(const Vector3f& orig, const Vector3f& dir, float tMax, float* t, float* b1,
+                float* b2) const;
+};
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+inline int TriangleBatch::hitMask(const Vector3f& orig, const Vector3f& dir, float tMax, float* t,
+                                  float* b1, float* b2) const
+{
+    using namespace simd;
+    const vfloat dx = set1(dir.x), dy = set1(dir.y), dz = set1(dir.z);
+    const vfloat e1x = load(e1[0]), e1y = load(e1[1]), e1z = load(e1[2]);
+    const vfloat e2x = load(e2[0]), e2y = load(e2[1]), e2z = load(e2[2]);
+
+    vfloat sx = sub(set1(orig.x), load(v0[0]));
+    vfloat sy = sub(set1(orig.y), load(v0[1]));
+    vfloat sz = sub(set1(orig.z), load(v0[2]));
+    // S1 = dir x E2, S2 = S x E1
+    vfloat s1x = sub(mul(dy, e2z), mul(dz, e2y));
+    vfloat s1y = sub(mul(dz, e2x), mul(dx, e2z));
+    vfloat s1z = sub(mul(dx, e2y), mul(dy, e2x));
+    vfloat s2x = sub(mul(sy, e1z), mul(sz, e1y));
+    vfloat s2y = sub(mul(sz, e1x), mul(sx, e1z));
+    vfloat s2z = sub(mul(sx, e1y), mul(sy, e1x));
+
+    vfloat divide = add(add(mul(s1x, e1x), mul(s1y, e1y)), mul(s1z, e1z));
+    vfloat tt = div(add(add(mul(s2x, e2x), mul(s2y, e2y)), mul(s2z, e2z)), divide);
+    vfloat u = div(add(add(mul(s1x, sx), mul(s1y, sy)), mul(s1z, sz)), divide);
+    vfloat v = div(add(add(mul(s2x, dx), mul(s2y, dy)), mul(s2z, dz)), divide);
+    vfloat w = sub(sub(set1(1.f), u), v);
+
+    const vfloat zero = set1(0.f);
+    vfloat hit = mask_and(gt(tt, zero), lt(tt, set1(tMax)));
+    hit = mask_and(hit, mask_and(gt(u, zero), gt(v, zero)));
+    hit = mask_and(hit, gt(w, zero));
+    store(t, tt);
+    store(b1, u);
+    store(b2, v);
+    return movemask(hit) & ((1 << count) - 1);
+}
+#else
+inline int TriangleBatch::hitMask(const Vector3f& orig, const Vector3f& dir, float tMax, float* t,
+                                  float* b1, float* b2) const
+{
+    int mask = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Vector3f E1(e1[0][i], e1[1][i], e1[2][i]);
+        Vector3f E2(e2[0][i], e2[1][i], e2[2][i]);
+        Vector3f S = orig - Vector3f(v0[0][i], v0[1][i], v0[2][i]);
+        Vector3f S1 = crossProduct(dir, E2);
+        Vector3f S2 = crossProduct(S, E1);
+        float divide = dotProduct(S1, E1);
+        t[i] = dotProduct(S2, E2) / divide;
+        b1[i] = dotProduct(S1, S) / divide;
+        b2[i] = dotProduct(S2, dir) / divide;
+        float b0 = 1 - b1[i] - b2[i];
+        if (t[i] > 0 && t[i] < tMax && b1[i] > 0 && b2[i] > 0 && b0 > 0)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+#endif
@@ -2,6 +2,9 @@
 #include <cassert>
 #include "BVH.hpp"
 
+static void collectStats(BVHBuildNode* node, double rootArea, int& nodes,
+                         int& leaves, double& cost);
+
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
@@ -23,6 +26,94 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
     printf(
         "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
         hrs, mins, secs);
+
+    int nodes = 0, leaves = 0;
+    double cost = 0;
+    collectStats(root, root->bounds.SurfaceArea(), nodes, leaves, cost);
+    printf("BVH (%s): %i primitives, %i nodes, %i leaves, SAH cost %.2f\n\n",
+           splitMethod == SplitMethod::SAH ? "SAH" : "NAIVE",
+           (int)primitives.size(), nodes, leaves, cost);
+}
+
+// Expected cost of tracing a ray through the tree: every node is weighted by
+// the chance of a ray hitting its box, i.e. its surface area relative to the
+// root. Traversing an interior node costs 1/8 of a primitive test.
+static void collectStats(BVHBuildNode* node, double rootArea, int& nodes,
+                         int& leaves, double& cost)
+{
+    ++nodes;
+    double p = node->bounds.SurfaceArea() / rootArea;
+    if (node->left == nullptr && node->right == nullptr) {
+        ++leaves;
+        cost += p;
+        return;
+    }
+    cost += 0.125 * p;
+    collectStats(node->left, rootArea, nodes, leaves, cost);
+    collectStats(node->right, rootArea, nodes, leaves, cost);
+}
+
+// Binned SAH: the centroids are dropped into nBuckets slices along dim, the
+// cost of splitting after every slice is evaluated and the primitives are
+// partitioned at the cheapest one. Returns objects.begin() if no slice
+// separates the primitives, the caller then falls back to the median split.
+std::vector<Object*>::iterator
+BVHAccel::partitionSAH(std::vector<Object*>& objects,
+                       const Bounds3& centroidBounds, int dim) const
+{
+    constexpr int nBuckets = 16;
+    float cMin = centroidBounds.pMin[dim], cMax = centroidBounds.pMax[dim];
+    if (cMax <= cMin)
+        return objects.begin();
+
+    auto bucketOf = [&](Object* o) {
+        const Vector3f centroid = o->getBounds().Centroid();
+        int b = (int)(nBuckets * (centroid[dim] - cMin) / (cMax - cMin));
+        return std::min(b, nBuckets - 1);
+    };
+
+    int counts[nBuckets] = {};
+    Bounds3 bucketBounds[nBuckets];
+    for (auto o : objects) {
+        int b = bucketOf(o);
+        ++counts[b];
+        bucketBounds[b] = Union(bucketBounds[b], o->getBounds());
+    }
+
+    // sweep from the right for the area and count behind every split...
+    double rightArea[nBuckets];
+    int rightCount[nBuckets];
+    Bounds3 acc;
+    int count = 0;
+    for (int i = nBuckets - 1; i > 0; --i) {
+        acc = Union(acc, bucketBounds[i]);
+        count += counts[i];
+        rightArea[i] = acc.SurfaceArea();
+        rightCount[i] = count;
+    }
+
+    // ...then from the left, keeping the cheapest split
+    double minCost = std::numeric_limits<double>::max();
+    int minBucket = -1;
+    acc = Bounds3();
+    count = 0;
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        acc = Union(acc, bucketBounds[i]);
+        count += counts[i];
+        if (count == 0 || rightCount[i + 1] == 0)
+            continue;
+        double cost = count * acc.SurfaceArea() +
+                      rightCount[i + 1] * rightArea[i + 1];
+        if (cost < minCost) {
+            minCost = cost;
+            minBucket = i;
+        }
+    }
+    if (minBucket < 0)
+        return objects.begin();
+
+    return std::partition(objects.begin(), objects.end(),
+                          [&](Object* o) { return bucketOf(o) <= minBucket; });
 }
 
 BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
@@ -54,29 +145,36 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
             centroidBounds =
                 Union(centroidBounds, objects[i]->getBounds().Centroid());
         int dim = centroidBounds.maxExtent();
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                       f2->getBounds().Centroid().x;
-            });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                       f2->getBounds().Centroid().y;
-            });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                       f2->getBounds().Centroid().z;
-            });
-            break;
+
+        auto middling = objects.begin();
+        if (splitMethod == SplitMethod::SAH)
+            middling = partitionSAH(objects, centroidBounds, dim);
+        // NAIVE, or SAH found nothing to split: cut at the median centroid
+        if (middling == objects.begin()) {
+            switch (dim) {
+            case 0:
+                std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+                    return f1->getBounds().Centroid().x <
+                           f2->getBounds().Centroid().x;
+                });
+                break;
+            case 1:
+                std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+                    return f1->getBounds().Centroid().y <
+                           f2->getBounds().Centroid().y;
+                });
+                break;
+            case 2:
+                std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+                    return f1->getBounds().Centroid().z <
+                           f2->getBounds().Centroid().z;
+                });
+                break;
+            }
+            middling = objects.begin() + (objects.size() / 2);
         }
 
         auto beginning = objects.begin();
-        auto middling = objects.begin() + (objects.size() / 2);
         auto ending = objects.end();
 
         auto leftshapes = std::vector<Object*>(beginning, middling);
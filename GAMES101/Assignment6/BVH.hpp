@@ -39,6 +39,9 @@ public:
 
     // BVHAccel Private Methods
     BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    std::vector<Object*>::iterator partitionSAH(std::vector<Object*>& objects,
+                                                const Bounds3& centroidBounds,
+                                                int dim) const;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
@@ -0,0 +1,124 @@
+//
+// Per-thread random number source for the path tracer.
+//
+
+#ifndef RAYTRACING_SAMPLER_H
+#define RAYTRACING_SAMPLER_H
+
+#include <cstdint>
+
+// PCG32 (pcg-random.org): 16 bytes of state, much cheaper than std::mt19937
+class PCG32
+{
+public:
+    PCG32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+    // initstate picks the position, initseq picks one of 2^63 streams
+    void seed(uint64_t initstate, uint64_t initseq)
+    {
+        state = 0u;
+        inc = (initseq << 1u) | 1u;
+        nextUInt();
+        state += initstate;
+        nextUInt();
+    }
+
+    uint32_t nextUInt()
+    {
+        uint64_t oldstate = state;
+        state = oldstate * 0x5851f42d4c957f2dULL + inc;
+        uint32_t xorshifted = (uint32_t)(((oldstate >> 18u) ^ oldstate) >> 27u);
+        uint32_t rot = (uint32_t)(oldstate >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    // uniform float in [0, 1), uses the top 24 bits so 1.0 is never returned
+    float nextFloat()
+    {
+        return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+enum class SamplerType { Independent, Halton };
+
+// Hands out the random numbers of one pixel sample. The renderer calls
+// startPixelSample before each sample, after that every get1D() call is the
+// next dimension of that sample. With the Halton type the first dimensions
+// come from a Halton sequence, randomized per pixel with a Cranley-Patterson
+// rotation, deeper dimensions fall back to PCG32.
+class Sampler
+{
+public:
+    SamplerType type = SamplerType::Independent;
+
+    void startPixelSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex)
+    {
+        pixelHash = hash((uint64_t)seed << 32 | pixel);
+        index = sampleIndex;
+        dimension = 0;
+        rng.seed(pixelHash, sampleIndex);
+    }
+
+    float get1D()
+    {
+        if (type == SamplerType::Halton && dimension < numPrimes) {
+            int d = dimension++;
+            float offset = (hash(pixelHash + d) >> 40) * (1.0f / 16777216.0f);
+            float u = radicalInverse(primes[d], index + 1) + offset;
+            u = u < 1.0f ? u : u - 1.0f;
+            // the sum can round up to 1.0 in float
+            return u < 1.0f ? u : 0x1.fffffep-1f;
+        }
+        return rng.nextFloat();
+    }
+
+private:
+    static constexpr int numPrimes = 16;
+    static constexpr uint32_t primes[numPrimes] = {2, 3, 5, 7, 11, 13, 17, 19,
+                                                   23, 29, 31, 37, 41, 43, 47, 53};
+
+    static float radicalInverse(uint32_t base, uint32_t a)
+    {
+        const float invBase = 1.0f / base;
+        uint64_t reversedDigits = 0;
+        float invBaseN = 1.0f;
+        while (a) {
+            uint32_t next = a / base;
+            uint32_t digit = a - next * base;
+            reversedDigits = reversedDigits * base + digit;
+            invBaseN *= invBase;
+            a = next;
+        }
+        float u = reversedDigits * invBaseN;
+        return u < 1.0f ? u : 0x1.fffffep-1f;
+    }
+
+    // splitmix64 finalizer
+    static uint64_t hash(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    PCG32 rng;
+    uint64_t pixelHash = 0;
+    uint32_t index = 0;
+    int dimension = 0;
+};
+
+// Each thread owns one sampler, so drawing numbers never needs a lock
+inline Sampler& get_sampler()
+{
+    thread_local Sampler sampler;
+    return sampler;
+}
+
+#endif //RAYTRACING_SAMPLER_H
@@ -20,6 +20,8 @@ public:
     int width = 1280;
     int height = 960;
     double fov = 90;
+    // how the scene BVH is split, meshes pick theirs in MeshTriangle
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 5;
 
@@ -78,7 +78,8 @@ public:
 class MeshTriangle : public Object
 {
 public:
-    MeshTriangle(const std::string& filename)
+    MeshTriangle(const std::string& filename,
+                 BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH)
     {
         objl::Loader loader;
         loader.LoadFile(filename);
@@ -126,7 +127,7 @@ public:
         for (auto& tri : triangles)
             ptrs.push_back(&tri);
 
-        bvh = new BVHAccel(ptrs);
+        bvh = new BVHAccel(ptrs, 1, splitMethod);
     }
 
     bool intersect(const Ray& ray) { return true; }
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include "Sampler.hpp"
 
 #undef M_PI
 #define M_PI 3.141592653589793f
@@ -38,11 +39,7 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
 // ȡ
 inline float get_random_float()
 {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
-
-    return dist(rng);
+    return get_sampler().get1D();
 }
 
 // ½
@@ -0,0 +1,69 @@
+//
+// Constant time sampling of a discrete distribution (Walker/Vose alias method).
+//
+
+#ifndef RAYTRACING_ALIASTABLE_H
+#define RAYTRACING_ALIASTABLE_H
+
+#include <algorithm>
+#include <vector>
+
+class AliasTable
+{
+public:
+    AliasTable() = default;
+
+    // weights need not be normalized, but at least one must be positive
+    explicit AliasTable(const std::vector<float>& weights) : bins(weights.size())
+    {
+        double sum = 0;
+        for (float w : weights)
+            sum += w;
+        std::vector<double> q(weights.size());
+        std::vector<int> under, over;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            bins[i].pmf = (float)(weights[i] / sum);
+            q[i] = weights[i] / sum * weights.size();
+            (q[i] < 1 ? under : over).push_back((int)i);
+        }
+        // every bin below average is topped up by one above it
+        while (!under.empty() && !over.empty()) {
+            int u = under.back(), o = over.back();
+            under.pop_back();
+            bins[u].q = (float)q[u];
+            bins[u].alias = o;
+            q[o] -= 1 - q[u];
+            if (q[o] < 1) {
+                over.pop_back();
+                under.push_back(o);
+            }
+        }
+        // whatever is left is 1 up to rounding
+        for (int i : under)
+            bins[i].q = 1;
+        for (int i : over)
+            bins[i].q = 1;
+    }
+
+    int size() const { return (int)bins.size(); }
+    float pmf(int i) const { return bins[i].pmf; }
+
+    // u in [0, 1) picks the bin and then, rescaled, the bin or its alias
+    int sample(float u) const
+    {
+        float scaled = u * bins.size();
+        int i = std::min((int)scaled, (int)bins.size() - 1);
+        return scaled - i < bins[i].q ? i : bins[i].alias;
+    }
+
+private:
+    struct Bin
+    {
+        float q = 1;    // probability of keeping i instead of the alias
+        int alias = 0;
+        float pmf = 0;
+    };
+    std::vector<Bin> bins;
+};
+
+#endif // RAYTRACING_ALIASTABLE_H
@@ -1,139 +1,698 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <future>
+#include <thread>
 #include "BVH.hpp"
 
+static void collectStats(BVHBuildNode* node, double rootArea, int& nodes,
+                         int& leaves, double& cost);
+
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
-                   SplitMethod splitMethod)
+                   SplitMethod splitMethod, Layout layout)
+    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
+      layout(layout), objects(new ObjectPrimitives(std::move(p))),
+      prims(objects.get())
+{
+    build();
+}
+
+BVHAccel::BVHAccel(const PrimitiveSet& prims, int maxPrimsInNode,
+                   SplitMethod splitMethod, Layout layout)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+      layout(layout), prims(&prims)
 {
-    time_t start, stop;
-    time(&start);
-    if (primitives.empty())
+    build();
+}
+
+static void deleteBuildTree(BVHBuildNode* node)
+{
+    if (node == nullptr)
         return;
+    deleteBuildTree(node->left);
+    deleteBuildTree(node->right);
+    delete node;
+}
+
+BVHAccel::~BVHAccel() { deleteBuildTree(root); }
+
+void BVHAccel::build()
+{
+    auto start = std::chrono::steady_clock::now();
+    const int nPrims = prims->primitiveCount();
+    if (nPrims == 0)
+        return;
+
+    // bounds, centroids and areas are fetched once, the build only moves
+    // these records around
+    primitiveInfo.resize(nPrims);
+    for (int i = 0; i < nPrims; ++i) {
+        BVHPrimitiveInfo& info = primitiveInfo[i];
+        info.index = i;
+        info.bounds = prims->primitiveBounds(i);
+        info.centroid = info.bounds.Centroid();
+        info.area = prims->primitiveArea(i);
+    }
+    const int threads = std::max(1u, std::thread::hardware_concurrency());
+    while ((1 << parallelDepth) < 2 * threads)
+        ++parallelDepth;
+    root = recursiveBuild(0, nPrims, 0);
+
+    orderedPrims.reserve(nPrims);
+    placeLeaves(root);
+    std::vector<BVHPrimitiveInfo>().swap(primitiveInfo);
+
+    if (layout == Layout::WIDE) {
+        collapseBVHTree(root);
+    }
+    else {
+        nodes.reserve(2 * nPrims);
+        flattenBVHTree(root);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+    printf("\rBVH Generation complete: \nTime Taken: %.2f ms\n\n", ms);
+
+    int nodes = 0, leaves = 0;
+    double cost = 0;
+    collectStats(root, root->bounds.SurfaceArea(), nodes, leaves, cost);
+    builtCost = cost;
+    printf("BVH (%s): %i primitives, %i nodes, %i leaves, SAH cost %.2f\n",
+           splitMethod == SplitMethod::SAH ? "SAH" : "NAIVE",
+           nPrims, nodes, leaves, cost);
+    if (layout == Layout::WIDE)
+        printf("  collapsed to %i nodes of %i children\n",
+               (int)wideNodes.size(), WideBVHNode::width);
+    printf("\n");
+}
+
+// Expected cost of tracing a ray through the tree: every node is weighted by
+// the chance of a ray hitting its box, i.e. its surface area relative to the
+// root. Traversing an interior node costs 1/8 of a primitive test.
+static void collectStats(BVHBuildNode* node, double rootArea, int& nodes,
+                         int& leaves, double& cost)
+{
+    ++nodes;
+    double p = node->bounds.SurfaceArea() / rootArea;
+    if (node->left == nullptr && node->right == nullptr) {
+        ++leaves;
+        cost += p * node->nPrimitives;
+        return;
+    }
+    cost += 0.125 * p;
+    collectStats(node->left, rootArea, nodes, leaves, cost);
+    collectStats(node->right, rootArea, nodes, leaves, cost);
+}
+
+// Bounds and areas of node and everything below it from the current
+// primitive bounds, the tree itself is left as it is
+void BVHAccel::refitNode(BVHBuildNode* node)
+{
+    if (node->left == nullptr && node->right == nullptr) {
+        node->bounds = Bounds3();
+        node->area = 0;
+        for (int i = 0; i < node->nPrimitives; ++i) {
+            int prim = orderedPrims[node->firstPrimOffset + i];
+            node->bounds = Union(node->bounds, prims->primitiveBounds(prim));
+            node->area += prims->primitiveArea(prim);
+        }
+        return;
+    }
+    refitNode(node->left);
+    refitNode(node->right);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+}
+
+bool BVHAccel::refit()
+{
+    if (root == nullptr)
+        return false;
+    refitNode(root);
+
+    int nNodes = 0, leaves = 0;
+    double cost = 0;
+    collectStats(root, root->bounds.SurfaceArea(), nNodes, leaves, cost);
+    if (cost > rebuildThreshold * builtCost) {
+        printf("BVH refit: SAH cost %.2f -> %.2f, rebuilding\n", builtCost,
+               cost);
+        deleteBuildTree(root);
+        root = nullptr;
+        orderedPrims.clear();
+        nodes.clear();
+        wideNodes.clear();
+        batches.clear();
+        build();
+        return true;
+    }
+
+    // same tree, so the flat copies only need their boxes again
+    if (layout == Layout::WIDE) {
+        wideNodes.clear();
+        collapseBVHTree(root);
+    }
+    else {
+        nodes.clear();
+        flattenBVHTree(root);
+    }
+    return false;
+}
 
-    root = recursiveBuild(primitives);
+// Binned SAH: the centroids are dropped into nBuckets slices along dim, the
+// cost of splitting after every slice is evaluated and primitiveInfo[start,
+// end) is partitioned at the cheapest one. Returns start if no slice
+// separates the primitives, the caller then falls back to the median split.
+int BVHAccel::partitionSAH(int start, int end, const Bounds3& centroidBounds,
+                           int dim)
+{
+    constexpr int nBuckets = 16;
+    float cMin = centroidBounds.pMin[dim], cMax = centroidBounds.pMax[dim];
+    if (cMax <= cMin)
+        return start;
 
-    time(&stop);
-    double diff = difftime(stop, start);
-    int hrs = (int)diff / 3600;
-    int mins = ((int)diff / 60) - (hrs * 60);
-    int secs = (int)diff - (hrs * 3600) - (mins * 60);
+    auto bucketOf = [&](const BVHPrimitiveInfo& info) {
+        int b = (int)(nBuckets * (info.centroid[dim] - cMin) / (cMax - cMin));
+        return std::min(b, nBuckets - 1);
+    };
 
-    printf(
-        "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
-        hrs, mins, secs);
+    int counts[nBuckets] = {};
+    Bounds3 bucketBounds[nBuckets];
+    for (int i = start; i < end; ++i) {
+        int b = bucketOf(primitiveInfo[i]);
+        ++counts[b];
+        bucketBounds[b] = Union(bucketBounds[b], primitiveInfo[i].bounds);
+    }
+
+    // sweep from the right for the area and count behind every split...
+    double rightArea[nBuckets];
+    int rightCount[nBuckets];
+    Bounds3 acc;
+    int count = 0;
+    for (int i = nBuckets - 1; i > 0; --i) {
+        acc = Union(acc, bucketBounds[i]);
+        count += counts[i];
+        rightArea[i] = acc.SurfaceArea();
+        rightCount[i] = count;
+    }
+
+    // ...then from the left, keeping the cheapest split
+    double minCost = std::numeric_limits<double>::max();
+    int minBucket = -1;
+    acc = Bounds3();
+    count = 0;
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        acc = Union(acc, bucketBounds[i]);
+        count += counts[i];
+        if (count == 0 || rightCount[i + 1] == 0)
+            continue;
+        double cost = count * acc.SurfaceArea() +
+                      rightCount[i + 1] * rightArea[i + 1];
+        if (cost < minCost) {
+            minCost = cost;
+            minBucket = i;
+        }
+    }
+    if (minBucket < 0)
+        return start;
+
+    auto first = primitiveInfo.begin();
+    return (int)(std::partition(first + start, first + end,
+                                [&](const BVHPrimitiveInfo& info) {
+                                    return bucketOf(info) <= minBucket;
+                                }) -
+                 first);
 }
 
-BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
+// Builds the subtree over primitiveInfo[start, end), which is partitioned in
+// place. Leaves only remember their range, placeLeaves lays them out once
+// the whole tree is there. The two halves of a large range are built
+// concurrently down to parallelDepth.
+BVHBuildNode* BVHAccel::recursiveBuild(int start, int end, int depth)
 {
     BVHBuildNode* node = new BVHBuildNode();
 
     // Compute bounds of all primitives in BVH node
     Bounds3 bounds;
-    for (int i = 0; i < objects.size(); ++i)
-        bounds = Union(bounds, objects[i]->getBounds());
-    if (objects.size() == 1) {
+    for (int i = start; i < end; ++i)
+        bounds = Union(bounds, primitiveInfo[i].bounds);
+    const int n = end - start;
+    if (n <= maxPrimsInNode) {
         // Create leaf _BVHBuildNode_
-        node->bounds = objects[0]->getBounds();
-        node->object = objects[0];
+        assert(depth < maxDepth && "BVH deeper than the traversal stacks");
+        node->bounds = bounds;
         node->left = nullptr;
         node->right = nullptr;
-        node->area = objects[0]->getArea();
+        node->area = 0;
+        node->firstPrimOffset = start;
+        node->nPrimitives = n;
+        for (int i = start; i < end; ++i)
+            node->area += primitiveInfo[i].area;
         return node;
     }
-    else if (objects.size() == 2) {
-        node->left = recursiveBuild(std::vector{objects[0]});
-        node->right = recursiveBuild(std::vector{objects[1]});
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        node->area = node->left->area + node->right->area;
-        return node;
+    // the lower centroids go left, the traversal relies on that order
+    Bounds3 centroidBounds;
+    for (int i = start; i < end; ++i)
+        centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+    int dim = centroidBounds.maxExtent();
+    node->splitAxis = dim;
+
+    int mid = start;
+    if (splitMethod == SplitMethod::SAH && depth < maxDepth / 2)
+        mid = partitionSAH(start, end, centroidBounds, dim);
+    // NAIVE, too deep, or SAH found nothing to split: cut at the median
+    // centroid
+    if (mid == start) {
+        mid = start + n / 2;
+        auto first = primitiveInfo.begin();
+        std::nth_element(first + start, first + mid, first + end,
+                         [dim](const BVHPrimitiveInfo& a,
+                               const BVHPrimitiveInfo& b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    }
+
+    if (depth < parallelDepth && n >= parallelBuildThreshold) {
+        auto left = std::async(std::launch::async, [=] {
+            return recursiveBuild(start, mid, depth + 1);
+        });
+        node->right = recursiveBuild(mid, end, depth + 1);
+        node->left = left.get();
     }
     else {
-        Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)
-            centroidBounds =
-                Union(centroidBounds, objects[i]->getBounds().Centroid());
-        int dim = centroidBounds.maxExtent();
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                       f2->getBounds().Centroid().x;
-            });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                       f2->getBounds().Centroid().y;
-            });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                       f2->getBounds().Centroid().z;
-            });
-            break;
-        }
+        node->left = recursiveBuild(start, mid, depth + 1);
+        node->right = recursiveBuild(mid, end, depth + 1);
+    }
+
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
+
+// Copies the primitive indices of the leaves into orderedPrims, depth-first
+// so a subtree covers one range of it, and points the leaves there. When the
+// leaves can hold whole batches they start on a multiple of the batch width,
+// which lets buildTriangleBatches map every leaf onto whole batches, and a
+// leaf is padded by less than one batch.
+void BVHAccel::placeLeaves(BVHBuildNode* node)
+{
+    if (node->left != nullptr || node->right != nullptr) {
+        placeLeaves(node->left);
+        placeLeaves(node->right);
+        return;
+    }
+    const int start = node->firstPrimOffset;
+    node->firstPrimOffset = (int)orderedPrims.size();
+    for (int i = start; i < start + node->nPrimitives; ++i)
+        orderedPrims.push_back(primitiveInfo[i].index);
+    const int align = maxPrimsInNode % TriangleBatch::width == 0
+                          ? TriangleBatch::width : 1;
+    while (orderedPrims.size() % align != 0)
+        orderedPrims.push_back(-1);
+}
+
+// Lay the tree out depth-first into nodes, returns the offset of node. The
+// leaves already point into orderedPrims, placeLeaves filled it.
+int BVHAccel::flattenBVHTree(BVHBuildNode* node)
+{
+    int offset = (int)nodes.size();
+    nodes.emplace_back();
+    nodes[offset].bounds = node->bounds;
+    if (node->left == nullptr && node->right == nullptr) {
+        nodes[offset].primitivesOffset = node->firstPrimOffset;
+        nodes[offset].nPrimitives = node->nPrimitives;
+    }
+    else {
+        nodes[offset].axis = node->splitAxis;
+        nodes[offset].nPrimitives = 0;
+        flattenBVHTree(node->left);
+        nodes[offset].secondChildOffset = flattenBVHTree(node->right);
+    }
+    return offset;
+}
 
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + (objects.size() / 2);
-        auto ending = objects.end();
+// Collapse the binary tree below node into WideBVHNodes, returns the offset of
+// the node. Interior children with the largest box are opened up until the
+// node is full, so the big boxes near the root are the ones that disappear.
+int BVHAccel::collapseBVHTree(BVHBuildNode* node)
+{
+    constexpr int width = WideBVHNode::width;
+    auto isLeaf = [](BVHBuildNode* n) {
+        return n->left == nullptr && n->right == nullptr;
+    };
 
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
+    std::vector<BVHBuildNode*> children;
+    if (isLeaf(node))
+        children.push_back(node);
+    else
+        children = {node->left, node->right};
+    while ((int)children.size() < width) {
+        int best = -1;
+        double bestArea = -1;
+        for (int i = 0; i < (int)children.size(); ++i) {
+            double area = children[i]->bounds.SurfaceArea();
+            if (!isLeaf(children[i]) && area > bestArea) {
+                best = i;
+                bestArea = area;
+            }
+        }
+        if (best < 0)
+            break;
+        BVHBuildNode* opened = children[best];
+        children[best] = opened->left;
+        children.push_back(opened->right);
+    }
 
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+    int offset = (int)wideNodes.size();
+    wideNodes.emplace_back();
+    WideBVHNode& wide = wideNodes[offset];
+    wide.nChildren = (uint8_t)children.size();
+    for (int i = 0; i < width; ++i) {
+        // unused slots get an inverted box, no ray enters it
+        const Bounds3 b = i < wide.nChildren ? children[i]->bounds : Bounds3();
+        for (int k = 0; k < 3; ++k) {
+            wide.bMin[k][i] = b.pMin[k];
+            wide.bMax[k][i] = b.pMax[k];
+        }
+        wide.child[i] = -1;
+        wide.nPrimitives[i] = 0;
+    }
+    for (int i = 0; i < (int)children.size(); ++i) {
+        if (isLeaf(children[i])) {
+            wideNodes[offset].child[i] = children[i]->firstPrimOffset;
+            wideNodes[offset].nPrimitives[i] = children[i]->nPrimitives;
+        }
+        else {
+            // the recursion may grow wideNodes, so index it again afterwards
+            int childOffset = collapseBVHTree(children[i]);
+            wideNodes[offset].child[i] = childOffset;
+        }
+    }
+    return offset;
+}
 
-        node->left = recursiveBuild(leftshapes);
-        node->right = recursiveBuild(rightshapes);
+void BVHAccel::buildTriangleBatches(const Vector3f* vertices,
+                                    const uint32_t* vertexIndex)
+{
+    constexpr int width = TriangleBatch::width;
+    assert(maxPrimsInNode % width == 0);
+    batches.assign((orderedPrims.size() + width - 1) / width, TriangleBatch());
+    for (size_t i = 0; i < orderedPrims.size(); ++i) {
+        // padding between the leaves stays an empty lane
+        int k = orderedPrims[i];
+        if (k < 0)
+            continue;
+        const Vector3f& v0 = vertices[vertexIndex[3 * k]];
+        const Vector3f& v1 = vertices[vertexIndex[3 * k + 1]];
+        const Vector3f& v2 = vertices[vertexIndex[3 * k + 2]];
+        batches[i / width].set(i % width, v0, v1 - v0, v2 - v0);
+    }
+}
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        node->area = node->left->area + node->right->area;
+// Closest hit among the n primitives at orderedPrims[offset], isect is only
+// replaced by a hit in front of it
+void BVHAccel::intersectLeaf(int offset, int n, const Ray& ray,
+                             Intersection& isect) const
+{
+    if (statsEnabled)
+        rayStats().primitiveTests += n;
+    if (!batches.empty()) {
+        // only the closest lane of a batch is handed to the owner for the
+        // full intersection record
+        constexpr int width = TriangleBatch::width;
+        for (int b = offset / width; b <= (offset + n - 1) / width; ++b) {
+            float t;
+            int lane = batches[b].intersect(ray, isect.distance, t);
+            if (lane < 0)
+                continue;
+            prims->intersectPrimitive(orderedPrims[b * width + lane], ray,
+                                      isect);
+        }
+        return;
     }
+    for (int i = 0; i < n; ++i)
+        prims->intersectPrimitive(orderedPrims[offset + i], ray, isect);
+}
 
-    return node;
+bool BVHAccel::intersectLeafP(int offset, int n, const Ray& ray) const
+{
+    if (statsEnabled)
+        rayStats().primitiveTests += n;
+    if (!batches.empty()) {
+        constexpr int width = TriangleBatch::width;
+        for (int b = offset / width; b <= (offset + n - 1) / width; ++b) {
+            if (batches[b].intersectP(ray, ray.t_max))
+                return true;
+        }
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        if (prims->intersectPrimitiveP(orderedPrims[offset + i], ray))
+            return true;
+    }
+    return false;
 }
 
+// Front-to-back traversal of the flattened tree with an explicit stack. The
+// child on the side the ray comes from is visited first, and boxes entered
+// beyond the closest hit found so far are skipped.
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
+    if (layout == Layout::WIDE)
+        return intersectWide(ray);
+
     Intersection isect;
-    if (!root)
+    if (nodes.empty())
         return isect;
-    isect = BVHAccel::getIntersection(root, ray);
+
+    std::array<int, 3> dirIsNeg;
+    dirIsNeg[0] = (ray.direction[0] > 0);
+    dirIsNeg[1] = (ray.direction[1] > 0);
+    dirIsNeg[2] = (ray.direction[2] > 0);
+
+    int toVisit[binaryStackSize];
+    int toVisitOffset = 0, current = 0;
+    NodeCounter visited;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        ++visited.n;
+        if (node.bounds.IntersectP(ray, ray.direction_inv, dirIsNeg,
+                                   isect.distance)) {
+            if (node.nPrimitives > 0) {
+                intersectLeaf(node.primitivesOffset, node.nPrimitives, ray,
+                              isect);
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (dirIsNeg[node.axis]) {
+                // ray goes towards +axis, the first (lower) child is nearer
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+            else {
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+        }
+        else {
+            if (toVisitOffset == 0)
+                break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
     return isect;
 }
 
-Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
+// Occlusion query: true as soon as any primitive is hit closer than
+// ray.t_max, there is no need to find the closest one
+bool BVHAccel::IntersectP(const Ray& ray) const
 {
-    // Traverse the BVH to find intersection
+    if (layout == Layout::WIDE)
+        return intersectWideP(ray);
+
+    if (nodes.empty())
+        return false;
+
     std::array<int, 3> dirIsNeg;
     dirIsNeg[0] = (ray.direction[0] > 0);
     dirIsNeg[1] = (ray.direction[1] > 0);
     dirIsNeg[2] = (ray.direction[2] > 0);
-    Intersection inter;
-    // 㣬boundbox޽㣬һжϣ
-    // εݹ飬ֱҶӽڵ㣬жҶӽڵдĸΡεǷн
-    if (!node->bounds.IntersectP(ray, ray.direction_inv, dirIsNeg)) {
-        return inter;
+
+    int toVisit[binaryStackSize];
+    int toVisitOffset = 0, current = 0;
+    NodeCounter visited;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        ++visited.n;
+        if (node.bounds.IntersectP(ray, ray.direction_inv, dirIsNeg,
+                                   ray.t_max)) {
+            if (node.nPrimitives > 0) {
+                if (intersectLeafP(node.primitivesOffset, node.nPrimitives,
+                                   ray))
+                    return true;
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (dirIsNeg[node.axis]) {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+            else {
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+        }
+        else {
+            if (toVisitOffset == 0)
+                break;
+            current = toVisit[--toVisitOffset];
+        }
     }
-    if (node->left == nullptr && node->right == nullptr) {
-        return node->object->getIntersection(ray);
+    return false;
+}
+
+// Slab test of ray against all children of node at once. Returns a mask of
+// the children entered before tMax, with their entry distances in tNear.
+static int intersectChildren(const WideBVHNode& node, const Ray& ray,
+                             const std::array<int, 3>& dirIsNeg, double tMax,
+                             float* tNear)
+{
+    const float tMaxf =
+        (float)std::min(tMax, (double)std::numeric_limits<float>::max());
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+    using namespace simd;
+    vfloat tEnter = set1(0.f), tExit = set1(tMaxf);
+    for (int k = 0; k < 3; ++k) {
+        const float* nearPlane = dirIsNeg[k] ? node.bMin[k] : node.bMax[k];
+        const float* farPlane = dirIsNeg[k] ? node.bMax[k] : node.bMin[k];
+        const vfloat o = set1(ray.origin[k]);
+        const vfloat invDir = set1(ray.direction_inv[k]);
+        tEnter = max(tEnter, mul(sub(load(nearPlane), o), invDir));
+        tExit = min(tExit, mul(sub(load(farPlane), o), invDir));
     }
+    store(tNear, tEnter);
+    return movemask(le(tEnter, tExit)) & ((1 << node.nChildren) - 1);
+#else
+    int mask = 0;
+    for (int i = 0; i < node.nChildren; ++i) {
+        float tEnter = 0.f, tExit = tMaxf;
+        for (int k = 0; k < 3; ++k) {
+            float nearPlane = dirIsNeg[k] ? node.bMin[k][i] : node.bMax[k][i];
+            float farPlane = dirIsNeg[k] ? node.bMax[k][i] : node.bMin[k][i];
+            tEnter = std::max(tEnter, (nearPlane - (float)ray.origin[k]) *
+                                          (float)ray.direction_inv[k]);
+            tExit = std::min(tExit, (farPlane - (float)ray.origin[k]) *
+                                        (float)ray.direction_inv[k]);
+        }
+        tNear[i] = tEnter;
+        if (tEnter <= tExit)
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+// Same front-to-back order as Intersect: the children that were hit are
+// sorted by entry distance, leaves are intersected right away and nodes are
+// pushed far to near together with their entry distance, so a node is
+// dropped when popped behind the closest hit.
+Intersection BVHAccel::intersectWide(const Ray& ray) const
+{
+    constexpr int width = WideBVHNode::width;
+    Intersection isect;
+    if (wideNodes.empty())
+        return isect;
+
+    std::array<int, 3> dirIsNeg;
+    dirIsNeg[0] = (ray.direction[0] > 0);
+    dirIsNeg[1] = (ray.direction[1] > 0);
+    dirIsNeg[2] = (ray.direction[2] > 0);
 
-    Intersection l = getIntersection(node->left, ray);
-    Intersection r = getIntersection(node->right, ray);
-    // ؾԴཻϢ
-    return l.distance < r.distance ? l : r;
+    struct StackEntry { int node; float tNear; };
+    StackEntry toVisit[wideStackSize];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = {0, 0.f};
+    NodeCounter visited;
+    while (toVisitOffset > 0) {
+        const StackEntry entry = toVisit[--toVisitOffset];
+        if (entry.tNear > isect.distance)
+            continue;
+        const WideBVHNode& node = wideNodes[entry.node];
+        ++visited.n;
+        alignas(32) float tNear[width];
+        int mask = intersectChildren(node, ray, dirIsNeg, isect.distance, tNear);
+
+        int order[width], nHit = 0;
+        for (int i = 0; i < width; ++i) {
+            if (!(mask >> i & 1))
+                continue;
+            int j = nHit++;
+            for (; j > 0 && tNear[order[j - 1]] > tNear[i]; --j)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+        for (int j = nHit - 1; j >= 0; --j) {
+            int i = order[j];
+            if (node.nPrimitives[i] == 0)
+                toVisit[toVisitOffset++] = {node.child[i], tNear[i]};
+        }
+        for (int j = 0; j < nHit; ++j) {
+            int i = order[j];
+            if (node.nPrimitives[i] > 0 && tNear[i] <= isect.distance)
+                intersectLeaf(node.child[i], node.nPrimitives[i], ray, isect);
+        }
+    }
+    return isect;
 }
 
+bool BVHAccel::intersectWideP(const Ray& ray) const
+{
+    constexpr int width = WideBVHNode::width;
+    if (wideNodes.empty())
+        return false;
+
+    std::array<int, 3> dirIsNeg;
+    dirIsNeg[0] = (ray.direction[0] > 0);
+    dirIsNeg[1] = (ray.direction[1] > 0);
+    dirIsNeg[2] = (ray.direction[2] > 0);
+
+    int toVisit[wideStackSize];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = 0;
+    NodeCounter visited;
+    while (toVisitOffset > 0) {
+        const WideBVHNode& node = wideNodes[toVisit[--toVisitOffset]];
+        ++visited.n;
+        alignas(32) float tNear[width];
+        int mask = intersectChildren(node, ray, dirIsNeg, ray.t_max, tNear);
+        for (int i = 0; i < width; ++i) {
+            if (!(mask >> i & 1))
+                continue;
+            if (node.nPrimitives[i] == 0)
+                toVisit[toVisitOffset++] = node.child[i];
+            else if (intersectLeafP(node.child[i], node.nPrimitives[i], ray))
+                return true;
+        }
+    }
+    return false;
+}
 
 void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
     if(node->left == nullptr || node->right == nullptr){
-        node->object->Sample(pos, pdf);
-        pdf *= node->area;
-        return;
+        // pick a primitive of the leaf by area, the last one absorbs rounding
+        for (int i = 0; i < node->nPrimitives; ++i) {
+            int prim = orderedPrims[node->firstPrimOffset + i];
+            float area = prims->primitiveArea(prim);
+            if (p < area || i == node->nPrimitives - 1) {
+                prims->samplePrimitive(prim, pos, pdf);
+                pdf *= area;
+                return;
+            }
+            p -= area;
+        }
     }
     if(p < node->left->area) getSample(node->left, p, pos, pdf);
     else getSample(node->right, p - node->left->area, pos, pdf);
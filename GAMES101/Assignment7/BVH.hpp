@@ -6,18 +6,75 @@
 #define RAYTRACING_BVH_H
 
 #include <atomic>
+#include <cassert>
 #include <vector>
 #include <memory>
-#include <ctime>
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
+#include "RayStats.hpp"
+#include "TriangleBatch.hpp"
 #include "Vector.hpp"
 
 struct BVHBuildNode;
 // BVHAccel Forward Declarations
-struct BVHPrimitiveInfo;
+struct LinearBVHNode;
+struct WideBVHNode;
+
+// Whatever a BVH is built over. Primitives are referred to by their index,
+// the BVH only keeps indices and leaves the geometry to its owner.
+class PrimitiveSet
+{
+public:
+    virtual ~PrimitiveSet() {}
+    virtual int primitiveCount() const = 0;
+    virtual Bounds3 primitiveBounds(int i) const = 0;
+    virtual float primitiveArea(int i) const = 0;
+    // replaces isect if primitive i is hit in front of it
+    virtual void intersectPrimitive(int i, const Ray& ray,
+                                    Intersection& isect) const = 0;
+    // any hit closer than ray.t_max
+    virtual bool intersectPrimitiveP(int i, const Ray& ray) const = 0;
+    // point uniformly distributed on primitive i, pdf by area
+    virtual void samplePrimitive(int i, Intersection& pos, float& pdf) const = 0;
+};
+
+// The objects of a scene as primitives, one per object
+class ObjectPrimitives : public PrimitiveSet
+{
+public:
+    explicit ObjectPrimitives(std::vector<Object*> objects)
+        : objects(std::move(objects)) {}
+
+    int primitiveCount() const override { return (int)objects.size(); }
+    Bounds3 primitiveBounds(int i) const override { return objects[i]->getBounds(); }
+    float primitiveArea(int i) const override { return objects[i]->getArea(); }
+    void intersectPrimitive(int i, const Ray& ray,
+                            Intersection& isect) const override
+    {
+        Intersection inter = objects[i]->getIntersection(ray);
+        if (inter.happened && inter.distance < isect.distance)
+            isect = inter;
+    }
+    bool intersectPrimitiveP(int i, const Ray& ray) const override
+    {
+        return objects[i]->intersect(ray);
+    }
+    void samplePrimitive(int i, Intersection& pos, float& pdf) const override
+    {
+        objects[i]->Sample(pos, pdf);
+    }
+
+    std::vector<Object*> objects;
+};
+
+struct BVHPrimitiveInfo {
+    int index;
+    Bounds3 bounds;
+    Vector3f centroid;
+    float area;
+};
 
 // BVHAccel Declarations
 inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
@@ -26,24 +83,84 @@ class BVHAccel {
 public:
     // BVHAccel Public Types
     enum class SplitMethod { NAIVE, SAH };
+    // BINARY traverses the built tree as is, WIDE collapses it into nodes of
+    // SIMD_WIDTH children whose boxes are tested together
+    enum class Layout { BINARY, WIDE };
 
     // BVHAccel Public Methods
-    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
+    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE,
+             Layout layout = Layout::BINARY);
+    // prims must outlive the BVH
+    BVHAccel(const PrimitiveSet& prims, int maxPrimsInNode = 1,
+             SplitMethod splitMethod = SplitMethod::NAIVE,
+             Layout layout = Layout::BINARY);
     Bounds3 WorldBound() const;
     ~BVHAccel();
 
     Intersection Intersect(const Ray &ray) const;
-    Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+
+    // Recomputes the boxes bottom-up after the primitives moved, keeping the
+    // tree. When that leaves the SAH cost above rebuildThreshold times the
+    // cost of the last build, the tree is built again from scratch. Returns
+    // true if it was. Triangle batches have to be rebuilt by the caller in
+    // either case.
+    bool refit();
+    float rebuildThreshold = 1.5f;
+    // the pointer tree is kept for Sample, rays traverse the flat copy
+    BVHBuildNode* root = nullptr;
+    std::vector<LinearBVHNode> nodes;
+    std::vector<WideBVHNode> wideNodes;
+    // primitive indices in leaf order, -1 pads a leaf to a batch boundary
+    std::vector<int> orderedPrims;
+    // SoA copies of the leaves, batch i holds orderedPrims[i * width, ...).
+    // Empty unless buildTriangleBatches was called.
+    std::vector<TriangleBatch> batches;
+
+    // Packs the leaves into TriangleBatches so they are intersected several
+    // triangles at a time. Primitive k must be the triangle of the vertices
+    // vertexIndex[3k], [3k + 1] and [3k + 2], and maxPrimsInNode a multiple
+    // of TriangleBatch::width.
+    void buildTriangleBatches(const Vector3f* vertices,
+                              const uint32_t* vertexIndex);
 
     // BVHAccel Private Methods
-    BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    void build();
+    BVHBuildNode* recursiveBuild(int start, int end, int depth);
+    int partitionSAH(int start, int end, const Bounds3& centroidBounds,
+                     int dim);
+    void placeLeaves(BVHBuildNode* node);
+    void refitNode(BVHBuildNode* node);
+    int flattenBVHTree(BVHBuildNode* node);
+    int collapseBVHTree(BVHBuildNode* node);
+    Intersection intersectWide(const Ray& ray) const;
+    bool intersectWideP(const Ray& ray) const;
+    void intersectLeaf(int offset, int n, const Ray& ray,
+                       Intersection& isect) const;
+    bool intersectLeafP(int offset, int n, const Ray& ray) const;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
-    std::vector<Object*> primitives;
+    const Layout layout;
+    // set when built from objects, prims then points to it
+    std::unique_ptr<ObjectPrimitives> objects;
+    const PrimitiveSet* prims;
+    // per primitive build input, only kept while building
+    std::vector<BVHPrimitiveInfo> primitiveInfo;
+    // subtrees of at least parallelBuildThreshold primitives are built on
+    // their own thread while less than parallelDepth levels deep
+    static constexpr int parallelBuildThreshold = 4096;
+    int parallelDepth = 0;
+    // The traversal stacks are fixed arrays with room for leaves up to
+    // maxDepth levels deep. Below maxDepth / 2 the build only cuts at the
+    // median, which halves the primitives and keeps any int count within it.
+    static constexpr int maxDepth = 64;
+    static constexpr int binaryStackSize = maxDepth;
+    // a wide node pops one entry and pushes at most width
+    static constexpr int wideStackSize = 1 + maxDepth * (SIMD_WIDTH - 1);
+    // SAH cost right after the last build, refit compares against it
+    double builtCost = 0;
 
     void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
     void Sample(Intersection &pos, float &pdf);
@@ -53,7 +170,6 @@ struct BVHBuildNode {
     Bounds3 bounds;
     BVHBuildNode *left;
     BVHBuildNode *right;
-    Object* object;
     float area;
 
 public:
@@ -62,11 +178,33 @@ public:
     BVHBuildNode(){
         bounds = Bounds3();
         left = nullptr;right = nullptr;
-        object = nullptr;
     }
 };
 
-
-
+// Node of the depth-first flattened tree. The first child of an interior
+// node directly follows it in memory, only the second one needs an offset.
+// 32 bytes, so two nodes share a cache line.
+struct alignas(32) LinearBVHNode {
+    Bounds3 bounds;
+    union {
+        int primitivesOffset;   // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nPrimitives;  // 0 -> interior node
+    uint8_t axis;          // interior node: axis the children were split on
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+// Node of the collapsed tree. The boxes of all children are stored one array
+// per component, so a single slab test culls all of them.
+struct alignas(32) WideBVHNode {
+    static constexpr int width = SIMD_WIDTH;
+    float bMin[3][width];
+    float bMax[3][width];
+    // leaf child: first primitive in orderedPrims, otherwise index of a node
+    int child[width];
+    uint16_t nPrimitives[width];  // 0 -> child is a WideBVHNode
+    uint8_t nChildren;
+};
 
 #endif //RAYTRACING_BVH_H
@@ -0,0 +1,194 @@
+// Rays per second through the scene BVH for every split method and layout,
+// on the Cornell box, on the Stanford bunny and on a grid of bunny
+// instances sharing one mesh BVH. Single threaded, so the numbers compare
+// the acceleration structures and not the thread pool.
+//
+// usage: BVHBench [models directory]
+
+#include "Bench.hpp"
+#include "MeshInstance.hpp"
+#include <chrono>
+#include <string>
+
+struct RaySet
+{
+    std::vector<Ray> closest;  // traced with Intersect
+    std::vector<Ray> shadow;   // traced with IntersectP, t_max set
+};
+
+// Camera rays of the Renderer at 256x256, one bounce from every hit in a
+// random direction of the upper hemisphere, and a shadow ray from every hit
+// towards a point on the light.
+static RaySet cornellRays(const Scene& scene)
+{
+    RaySet rays;
+    std::mt19937 rng(7);
+    const int res = 256;
+    float scale = std::tan(scene.fov * 0.5 * M_PI / 180.0);
+    Vector3f eye_pos(278, 273, -800);
+    for (int j = 0; j < res; ++j) {
+        for (int i = 0; i < res; ++i) {
+            float x = (2 * (i + 0.5) / (float)res - 1) * scale;
+            float y = (1 - 2 * (j + 0.5) / (float)res) * scale;
+            Ray primary(eye_pos, normalize(Vector3f(-x, y, 1)));
+            rays.closest.push_back(primary);
+
+            Intersection hit = scene.intersect(primary);
+            if (!hit.happened || hit.m->hasEmission())
+                continue;
+            Vector3f N = hit.normal;
+            Vector3f wi = uniformSphere(rng);
+            if (dotProduct(wi, N) < 0)
+                wi = -wi;
+            rays.closest.emplace_back(hit.coords, wi);
+
+            Intersection light;
+            float pdf;
+            get_sampler().startPixelSample(0, j * res + i, 0);
+            scene.sampleLight(light, pdf);
+            Vector3f toLight = light.coords - hit.coords;
+            float d = toLight.norm();
+            Ray shadow(hit.coords, toLight / d);
+            shadow.t_max = d - 0.001;
+            rays.shadow.push_back(shadow);
+        }
+    }
+    return rays;
+}
+
+// Rays into the bounds, the shadow rays stop halfway to their targets
+static RaySet meshRays(const Bounds3& b, int n)
+{
+    RaySet rays;
+    std::vector<float> targets;
+    rays.closest = boundsRays(b, n, 7, &targets);
+    for (int i = 0; i < n; ++i) {
+        Ray shadow = rays.closest[i];
+        shadow.t_max = 0.5 * targets[i];
+        rays.shadow.push_back(shadow);
+    }
+    return rays;
+}
+
+// An 8x8 grid of copies of mesh, each turned about the y axis and scaled
+// by its own amount, so the top level BVH sees overlapping instance bounds
+// of different sizes. The scene only points to them, as with the meshes.
+static std::vector<std::unique_ptr<MeshInstance>> instanceGrid(
+    Scene& scene, MeshTriangle* mesh)
+{
+    std::vector<std::unique_ptr<MeshInstance>> instances;
+    Bounds3 b = mesh->getBounds();
+    Vector3f center = 0.5 * b.pMin + 0.5 * b.pMax;
+    float spacing = b.Diagonal().norm();
+    for (int i = 0; i < 64; ++i) {
+        Vector3f offset((i % 8) * spacing, 0, (i / 8) * spacing);
+        Transform toWorld = Transform::translate(offset) *
+                            Transform::rotate(i * 37.f, Vector3f(0, 1, 0)) *
+                            Transform::scale(Vector3f(0.75f + 0.25f * (i % 3))) *
+                            Transform::translate(-center);
+        instances.emplace_back(new MeshInstance(mesh, toWorld));
+        scene.Add(instances.back().get());
+    }
+    scene.buildBVH();
+    return instances;
+}
+
+// millions of rays per second, best of three runs
+template <typename F>
+static double measure(const std::vector<Ray>& rays, F trace)
+{
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        int hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const Ray& ray : rays)
+            hits += trace(ray);
+        auto stop = std::chrono::steady_clock::now();
+        double secs = std::chrono::duration<double>(stop - start).count();
+        best = std::max(best, rays.size() / secs * 1e-6);
+        if (hits < 0)
+            printf("unreachable\n");
+    }
+    return best;
+}
+
+static std::string report(const char* scene, BVHAccel::SplitMethod split,
+                          BVHAccel::Layout layout, const Scene& s,
+                          const RaySet& rays)
+{
+    double closest = measure(rays.closest, [&](const Ray& r) {
+        return (int)s.intersect(r).happened;
+    });
+    double shadow = measure(rays.shadow, [&](const Ray& r) {
+        return (int)s.intersectP(r);
+    });
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %-6s %-7s %12.2f %12.2f\n", scene,
+             split == BVHAccel::SplitMethod::SAH ? "SAH" : "NAIVE",
+             layout == BVHAccel::Layout::WIDE ? "WIDE" : "BINARY", closest,
+             shadow);
+    return line;
+}
+
+int main(int argc, char** argv)
+{
+    std::string models = argc > 1 ? argv[1] : "models";
+
+    BenchMaterials materials;
+
+    std::vector<std::string> results;
+    const BVHAccel::SplitMethod splits[] = {BVHAccel::SplitMethod::NAIVE,
+                                            BVHAccel::SplitMethod::SAH};
+    const BVHAccel::Layout layouts[] = {BVHAccel::Layout::BINARY,
+                                        BVHAccel::Layout::WIDE};
+
+    RaySet cornell, bunny, instanced;
+    for (auto split : splits) {
+        for (auto layout : layouts) {
+            // meshes and scene share the configuration, the rays are fixed
+            // by the first build so every row traces the same set
+            Scene scene(784, 784);
+            auto meshes = loadCornellBox(scene, models, materials, split,
+                                         layout);
+            if (cornell.closest.empty())
+                cornell = cornellRays(scene);
+
+            MeshTriangle bunnyMesh(models + "/bunny/bunny.obj",
+                                   materials.white, split, layout);
+            Scene bunnyScene(784, 784);
+            bunnyScene.splitMethod = split;
+            bunnyScene.bvhLayout = layout;
+            bunnyScene.Add(&bunnyMesh);
+            bunnyScene.buildBVH();
+            if (bunny.closest.empty())
+                bunny = meshRays(bunnyMesh.getBounds(), 500000);
+
+            // the same mesh BVH as bottom level under a top level of
+            // instances, built with the configuration of the row as well
+            Scene instanceScene(784, 784);
+            instanceScene.splitMethod = split;
+            instanceScene.bvhLayout = layout;
+            auto instances = instanceGrid(instanceScene, &bunnyMesh);
+            if (instanced.closest.empty()) {
+                Bounds3 b;
+                for (const auto& instance : instances)
+                    b = Union(b, instance->getBounds());
+                instanced = meshRays(b, 500000);
+            }
+
+            results.push_back(
+                report("cornellbox", split, layout, scene, cornell));
+            results.push_back(
+                report("bunny", split, layout, bunnyScene, bunny));
+            results.push_back(report("bunny x64", split, layout,
+                                     instanceScene, instanced));
+        }
+    }
+
+    // the builds print their own statistics, the table comes last
+    printf("%-10s %-6s %-7s %12s %12s\n", "scene", "split", "layout",
+           "closest Mr/s", "shadow Mr/s");
+    for (const std::string& line : results)
+        printf("%s", line.c_str());
+    return 0;
+}
@@ -0,0 +1,85 @@
+//
+// Scenes and rays shared by BVHBench and KernelBench. Everything comes from
+// fixed seeds, so both benches trace the same rays on every run.
+//
+
+#ifndef RAYTRACING_BENCH_H
+#define RAYTRACING_BENCH_H
+
+#include "Scene.hpp"
+#include "Triangle.hpp"
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+inline Vector3f uniformSphere(std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> U(0.f, 1.f);
+    float z = 1 - 2 * U(rng), phi = 2 * M_PI * U(rng);
+    float r = std::sqrt(std::max(0.f, 1 - z * z));
+    return Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Rays from a sphere around the bounds aimed at random points inside them,
+// so most of them reach the geometry and some pass beside it. The distance
+// of each ray to its target point goes to targets if it is given.
+inline std::vector<Ray> boundsRays(const Bounds3& b, int n, uint32_t seed,
+                                   std::vector<float>* targets = nullptr)
+{
+    std::vector<Ray> rays;
+    rays.reserve(n);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> U(0.f, 1.f);
+    Vector3f center = 0.5 * b.pMin + 0.5 * b.pMax;
+    float radius = b.Diagonal().norm();
+    for (int i = 0; i < n; ++i) {
+        Vector3f o = center + uniformSphere(rng) * radius;
+        Vector3f target = b.pMin + Vector3f(U(rng), U(rng), U(rng)) * b.Diagonal();
+        rays.emplace_back(o, normalize(target - o));
+        if (targets)
+            targets->push_back((target - o).norm());
+    }
+    return rays;
+}
+
+// The white and the emitting material of the Cornell box, the benches do
+// not need the colored walls
+struct BenchMaterials
+{
+    Material* white;
+    Material* light;
+
+    BenchMaterials()
+    {
+        white = new Material(DIFFUSE, Vector3f(0.0f));
+        white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
+        light = new Material(DIFFUSE, Vector3f(47.8f, 38.6f, 31.1f));
+        light->Kd = Vector3f(0.65f);
+    }
+};
+
+// Loads the Cornell box meshes from the models directory into scene, which
+// only points to them, so they live in the returned vector. Meshes and the
+// scene BVH are built with the same split method and layout.
+inline std::vector<std::unique_ptr<MeshTriangle>> loadCornellBox(
+    Scene& scene, const std::string& models, const BenchMaterials& materials,
+    BVHAccel::SplitMethod split = BVHAccel::SplitMethod::SAH,
+    BVHAccel::Layout layout = BVHAccel::Layout::BINARY)
+{
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+    scene.splitMethod = split;
+    scene.bvhLayout = layout;
+    for (const char* name : {"floor", "shortbox", "tallbox", "left", "right",
+                             "light"}) {
+        meshes.emplace_back(new MeshTriangle(
+            models + "/cornellbox/" + name + ".obj",
+            std::string(name) == "light" ? materials.light : materials.white,
+            split, layout));
+        scene.Add(meshes.back().get());
+    }
+    scene.buildBVH();
+    return meshes;
+}
+
+#endif // RAYTRACING_BENCH_H
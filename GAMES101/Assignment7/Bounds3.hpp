@@ -86,6 +86,10 @@ class Bounds3
 
     inline bool IntersectP(const Ray& ray, const Vector3f& invDir,
                            const std::array<int, 3>& dirisNeg) const;
+    // same test, but boxes entered beyond tMax count as a miss
+    inline bool IntersectP(const Ray& ray, const Vector3f& invDir,
+                           const std::array<int, 3>& dirIsNeg,
+                           double tMax) const;
 };
 
 
@@ -132,6 +136,27 @@ inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
         return false;
 }
 
+inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
+                                const std::array<int, 3>& dirIsNeg,
+                                double tMax) const
+{
+    // pick the near/far slab directly instead of swapping afterwards
+    const Vector3f& nearX = dirIsNeg[0] ? pMin : pMax;
+    const Vector3f& nearY = dirIsNeg[1] ? pMin : pMax;
+    const Vector3f& nearZ = dirIsNeg[2] ? pMin : pMax;
+    const Vector3f& farX = dirIsNeg[0] ? pMax : pMin;
+    const Vector3f& farY = dirIsNeg[1] ? pMax : pMin;
+    const Vector3f& farZ = dirIsNeg[2] ? pMax : pMin;
+
+    float t_enter = std::max((nearX.x - ray.origin.x) * invDir.x,
+                    std::max((nearY.y - ray.origin.y) * invDir.y,
+                             (nearZ.z - ray.origin.z) * invDir.z));
+    float t_exit = std::min((farX.x - ray.origin.x) * invDir.x,
+                   std::min((farY.y - ray.origin.y) * invDir.y,
+                            (farZ.z - ray.origin.z) * invDir.z));
+    return t_enter <= t_exit && t_exit >= 0 && t_enter <= tMax;
+}
+
 inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
 {
     Bounds3 ret;
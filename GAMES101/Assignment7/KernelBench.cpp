@@ -0,0 +1,169 @@
+// Time per call of the kernels a render spends its time in: the box slab
+// test, the triangle and sphere tests, building a BVH and tracing rays
+// through one, on synthetic inputs and on the bundled models. The inputs
+// come from fixed seeds, so two runs on the same machine trace the same
+// rays and the hits column must not change; a change there is a bug, not
+// a speedup.
+//
+// usage: KernelBench [models directory]
+
+#include "Bench.hpp"
+#include "Sphere.hpp"
+#include <chrono>
+#include <string>
+
+// n small triangles scattered through the unit cube
+static std::vector<Triangle> triangleSoup(int n, uint32_t seed)
+{
+    std::vector<Triangle> soup;
+    soup.reserve(n);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> U(0.f, 1.f);
+    float size = 2.f / std::cbrt((float)n);
+    for (int i = 0; i < n; ++i) {
+        Vector3f v0(U(rng), U(rng), U(rng));
+        Vector3f v1 = v0 + (Vector3f(U(rng), U(rng), U(rng)) - Vector3f(0.5f)) * size;
+        Vector3f v2 = v0 + (Vector3f(U(rng), U(rng), U(rng)) - Vector3f(0.5f)) * size;
+        soup.emplace_back(v0, v1, v2);
+    }
+    return soup;
+}
+
+struct Result
+{
+    std::string kernel, input;
+    const char* unit;  // what one op is
+    long ops;          // ops per run
+    long hits;         // ops that reported a hit, the same on every run
+    double ns;         // nanoseconds per op, best run
+};
+
+static std::vector<Result> results;
+
+// Calls op(i) for i in [0, n) runs times and keeps the fastest run. op
+// returns whether it hit; the count keeps the calls from being optimized
+// away and is reported so that a wrong kernel shows up as well as a slow one.
+template <typename F>
+static void measure(const char* kernel, const std::string& input, long n,
+                    F op)
+{
+    Result r{kernel, input, "ray", n, 0, 0};
+    const int runs = 5;
+    double best = 1e300;
+    for (int run = 0; run < runs; ++run) {
+        long hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < n; ++i)
+            hits += op(i);
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(
+                                  stop - start).count());
+        r.hits = hits;
+    }
+    r.ns = best / n;
+    results.push_back(r);
+}
+
+// Builds the BVH of prims from scratch, best of three builds. One op is one
+// primitive, so meshes of different sizes compare per primitive.
+template <typename Prims>
+static void measureBuild(const std::string& input, const Prims& prims,
+                         long nPrims, int maxPrimsInNode)
+{
+    Result r{"BVH build", input, "prim", nPrims, 0, 0};
+    double best = 1e300;
+    for (int run = 0; run < 3; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        BVHAccel bvh(prims, maxPrimsInNode, BVHAccel::SplitMethod::SAH);
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(
+                                  stop - start).count());
+    }
+    r.ns = best / nPrims;
+    results.push_back(r);
+}
+
+static void measureTraversal(const std::string& input, const BVHAccel& bvh,
+                             const std::vector<Ray>& rays)
+{
+    measure("BVH Intersect", input, rays.size(), [&](long i) {
+        return (long)bvh.Intersect(rays[i]).happened;
+    });
+    measure("BVH IntersectP", input, rays.size(), [&](long i) {
+        return (long)bvh.IntersectP(rays[i]);
+    });
+}
+
+int main(int argc, char** argv)
+{
+    std::string models = argc > 1 ? argv[1] : "models";
+    const int nRays = 1 << 18;
+
+    BenchMaterials materials;
+    Material* white = materials.white;
+
+    // single primitives: rays from around the unit cube into it
+    Bounds3 unit(Vector3f(0, 0, 0), Vector3f(1, 1, 1));
+    std::vector<Ray> unitRays = boundsRays(unit, nRays, 1);
+
+    // dirIsNeg holds whether each component is positive, as in the BVH
+    measure("Bounds3::IntersectP", "unit box", nRays, [&](long i) {
+        const Ray& ray = unitRays[i];
+        std::array<int, 3> dirIsNeg = {ray.direction.x > 0, ray.direction.y > 0,
+                                       ray.direction.z > 0};
+        return (long)unit.IntersectP(ray, ray.direction_inv, dirIsNeg,
+                                     ray.t_max);
+    });
+
+    Triangle triangle(Vector3f(0, 0, 0.5f), Vector3f(1, 0, 0.5f),
+                      Vector3f(0, 1, 0.5f), white);
+    measure("Triangle::getIntersection", "unit triangle", nRays, [&](long i) {
+        return (long)triangle.getIntersection(unitRays[i]).happened;
+    });
+
+    Sphere sphere(Vector3f(0.5f, 0.5f, 0.5f), 0.5f, white);
+    measure("Sphere::intersect", "unit sphere", nRays, [&](long i) {
+        float tnear;
+        uint32_t index;
+        return (long)sphere.intersect(unitRays[i], tnear, index);
+    });
+    measure("Sphere::getIntersection", "unit sphere", nRays, [&](long i) {
+        return (long)sphere.getIntersection(unitRays[i]).happened;
+    });
+
+    // synthetic: a BVH over separate Triangle objects
+    std::vector<Triangle> soup = triangleSoup(100000, 2);
+    std::vector<Object*> soupObjects;
+    for (Triangle& t : soup)
+        soupObjects.push_back(&t);
+    std::string soupName = "soup " + std::to_string(soup.size());
+    measureBuild(soupName, soupObjects, soupObjects.size(), 1);
+    {
+        BVHAccel bvh(soupObjects, 1, BVHAccel::SplitMethod::SAH);
+        measureTraversal(soupName, bvh, boundsRays(unit, nRays, 3));
+    }
+
+    // bundled models: the mesh BVHs with their triangle batches, as rendered
+    MeshTriangle bunny(models + "/bunny/bunny.obj", white);
+    measureBuild("bunny", bunny, bunny.primitiveCount(),
+                 TriangleBatch::width);
+    measureTraversal("bunny", *bunny.bvh,
+                     boundsRays(bunny.getBounds(), nRays, 4));
+
+    Scene cornell(784, 784);
+    auto meshes = loadCornellBox(cornell, models, materials);
+    Bounds3 cornellBounds;
+    for (const auto& mesh : meshes)
+        cornellBounds = Union(cornellBounds, mesh->getBounds());
+    // rays start outside the box, most of them enter it through the open side
+    measureTraversal("cornellbox", *cornell.bvh,
+                     boundsRays(cornellBounds, nRays, 5));
+
+    // the builds print their own statistics, the table comes last
+    printf("\n%-26s %-14s %-5s %8s %8s %10s %10s\n", "kernel", "input",
+           "op", "ops", "hits", "ns/op", "Mops/s");
+    for (const Result& r : results)
+        printf("%-26s %-14s %-5s %8ld %8ld %10.2f %10.2f\n", r.kernel.c_str(),
+               r.input.c_str(), r.unit, r.ops, r.hits, r.ns, 1e3 / r.ns);
+    return 0;
+}
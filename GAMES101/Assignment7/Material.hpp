@@ -133,10 +133,11 @@ Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
     switch(m_type){
         case DIFFUSE:
         {
-            // uniform sample on the hemisphere
+            // cosine weighted sample on the hemisphere, cancels the cosine
+            // of the rendering equation against the pdf
             float x_1 = get_random_float(), x_2 = get_random_float();
-            float z = std::fabs(1.0f - 2.0f * x_1);
-            float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * x_2;
+            float z = std::sqrt(1.0f - x_1);
+            float r = std::sqrt(x_1), phi = 2 * M_PI * x_2;
             Vector3f localRay(r*std::cos(phi), r*std::sin(phi), z);
             return toWorld(localRay, N);
             
@@ -149,9 +150,10 @@ float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
     switch(m_type){
         case DIFFUSE:
         {
-            // uniform sample probability 1 / (2 * PI)
-            if (dotProduct(wo, N) > 0.0f)
-                return 0.5f / M_PI;
+            // cosine weighted sample probability cos / PI
+            float cosalpha = dotProduct(wo, N);
+            if (cosalpha > 0.0f)
+                return cosalpha / M_PI;
             else
                 return 0.0f;
             break;
@@ -0,0 +1,112 @@
+//
+// One placement of a mesh in the scene. The mesh and its BVH (the bottom
+// level) are built once and shared by all instances, the scene BVH (the top
+// level) only sees the instances. Rays are moved into the space of the mesh
+// at the instance, so moving an instance only needs the scene BVH rebuilt.
+//
+// Light sampling maps an area uniform point of the mesh into the world, which
+// stays area uniform only under rotations, translations and uniform scales.
+// Emissive instances have to keep to those; others may take any transform.
+//
+
+#ifndef RAYTRACING_MESHINSTANCE_H
+#define RAYTRACING_MESHINSTANCE_H
+
+#include <cassert>
+#include <cmath>
+#include "Object.hpp"
+#include "Transform.hpp"
+#include "Triangle.hpp"
+
+class MeshInstance : public Object
+{
+public:
+    // the mesh is not added to the scene itself, only its instances are.
+    // material overrides the one of the mesh when given.
+    MeshInstance(MeshTriangle* mesh, const Transform& toWorld,
+                 Material* material = nullptr)
+        : mesh(mesh), m(material ? material : mesh->m)
+    {
+        setTransform(toWorld);
+    }
+
+    void setTransform(const Transform& toWorld)
+    {
+        transform = toWorld;
+        bounds = transform.bounds(mesh->getBounds());
+        assert((!m->hasEmission() || transform.isSimilarity()) &&
+               "emissive instances cannot be sampled under a non-uniform scale");
+        area = 0;
+        for (uint32_t k = 0; k < mesh->numTriangles; ++k) {
+            Vector3f v0 = transform.point(mesh->vertex(k, 0));
+            Vector3f v1 = transform.point(mesh->vertex(k, 1));
+            Vector3f v2 = transform.point(mesh->vertex(k, 2));
+            area += crossProduct(v1 - v0, v2 - v0).norm() * 0.5f;
+        }
+    }
+
+    // The object space ray keeps the parameter t: its direction is not
+    // normalized, so distances found by the mesh are world distances.
+    Ray toObject(const Ray& ray) const
+    {
+        Ray local(transform.inversePoint(ray.origin),
+                  transform.inverseVector(ray.direction), ray.t);
+        local.t_min = ray.t_min;
+        local.t_max = ray.t_max;
+        return local;
+    }
+
+    bool intersect(const Ray& ray) { return mesh->intersect(toObject(ray)); }
+
+    bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
+    {
+        return mesh->intersect(toObject(ray), tnear, index);
+    }
+
+    Intersection getIntersection(Ray ray)
+    {
+        Intersection inter = mesh->getIntersection(toObject(ray));
+        if (!inter.happened)
+            return inter;
+        inter.coords = ray(inter.distance);
+        inter.normal = normalize(transform.normal(inter.normal));
+        inter.obj = this;
+        inter.m = m;
+        return inter;
+    }
+
+    void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
+                              const uint32_t& index, const Vector2f& uv,
+                              Vector3f& N, Vector2f& st) const
+    {
+        mesh->getSurfaceProperties(transform.inversePoint(P),
+                                   transform.inverseVector(I), index, uv, N, st);
+        N = normalize(transform.normal(N));
+    }
+
+    Vector3f evalDiffuseColor(const Vector2f& st) const
+    {
+        return mesh->evalDiffuseColor(st);
+    }
+
+    Bounds3 getBounds() { return bounds; }
+    float getArea() { return area; }
+    bool hasEmit() { return m->hasEmission(); }
+
+    void Sample(Intersection& pos, float& pdf)
+    {
+        mesh->Sample(pos, pdf);
+        pos.coords = transform.point(pos.coords);
+        pos.normal = normalize(transform.normal(pos.normal));
+        pos.emit = m->getEmission();
+        pdf = 1.0f / area;
+    }
+
+    MeshTriangle* mesh;
+    Transform transform;  // object to world
+    Bounds3 bounds;
+    float area;
+    Material* m;
+};
+
+#endif // RAYTRACING_MESHINSTANCE_H
@@ -0,0 +1,383 @@
+//
+// Triangle meshes from OBJ files as one shared vertex array and an index
+// buffer. The OBJ text is parsed in place from a memory mapped file. When
+// RAYTRACING_MESH_CACHE_DIR names a directory, which CMake points into the
+// build directory, the result is written there as a binary cache that later
+// loads map and use without parsing or copying anything.
+//
+
+#ifndef RAYTRACING_MESHLOADER_H
+#define RAYTRACING_MESHLOADER_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the cache stores positions as they are in memory
+static_assert(sizeof(Vector3f) == 3 * sizeof(float),
+              "Vector3f must be three packed floats");
+
+// Read only view of a whole file, unmapped when destroyed
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        std::swap(ptr, other.ptr);
+        std::swap(length, other.length);
+        return *this;
+    }
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                  nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY,
+                                                0, 0, nullptr);
+            if (mapping) {
+                ptr = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+            length = ptr ? (size_t)size.QuadPart : 0;
+        }
+        CloseHandle(file);
+        return ptr != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ptr = (const char*)p;
+                length = st.st_size;
+            }
+        }
+        ::close(fd);
+        return ptr != nullptr;
+#endif
+    }
+
+    void close()
+    {
+        if (!ptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(ptr);
+#else
+        munmap((void*)ptr, length);
+#endif
+        ptr = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+};
+
+// Vertices are shared between triangles, triangle k is made of
+// positions[indices[3k]], positions[indices[3k+1]] and positions[indices[3k+2]].
+// The arrays live either in the vectors below or in the mapped cache file.
+struct IndexedMesh
+{
+    uint32_t numVertices = 0;
+    uint32_t numTriangles = 0;
+    const Vector3f* positions = nullptr;
+    const uint32_t* indices = nullptr;
+
+    std::vector<Vector3f> ownedPositions;
+    std::vector<uint32_t> ownedIndices;
+    MappedFile mapped;
+};
+
+namespace meshio {
+
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;    // the OBJ the cache was made from, a cache is
+    int64_t sourceTime;     // stale once either of them changes
+    uint32_t numVertices;
+    uint32_t numTriangles;
+};
+
+constexpr char cacheMagic[4] = {'A', '7', 'M', 'S'};
+constexpr uint32_t cacheVersion = 1;
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && isSpace(*p))
+        ++p;
+    return p;
+}
+
+inline const char* skipLine(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        ++p;
+    return p < end ? p + 1 : end;
+}
+
+// Floating point from_chars is missing from some standard libraries, which
+// then do not define __cpp_lib_to_chars. strtof needs a terminated string,
+// so the number is copied out of the mapped file first.
+inline const char* parseFloat(const char* p, const char* end, float& value)
+{
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+')
+        ++p;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+#else
+    char number[64];
+    size_t n = 0;
+    while (p + n < end && n < sizeof(number) - 1 && !isSpace(p[n]) &&
+           p[n] != '\n' && p[n] != '#')
+        ++n;
+    std::copy(p, p + n, number);
+    number[n] = '\0';
+    char* last;
+    value = std::strtof(number, &last);
+    return last != number ? p + (last - number) : nullptr;
+#endif
+}
+
+// Parses "v" and "f" lines, anything else (normals, texture coordinates,
+// groups, materials) is skipped. Faces with more than three corners are
+// split into a fan, negative indices count back from the last vertex.
+inline bool parseObj(const char* p, const char* end, IndexedMesh& mesh,
+                     std::string& error)
+{
+    std::vector<Vector3f>& positions = mesh.ownedPositions;
+    std::vector<uint32_t>& indices = mesh.ownedIndices;
+    int line = 1;
+    for (; p < end; p = skipLine(p, end), ++line) {
+        p = skipSpaces(p, end);
+        if (end - p < 2 || !isSpace(p[1]))
+            continue;
+        if (p[0] == 'v') {
+            Vector3f v;
+            const char* q = p + 1;
+            if (!(q = parseFloat(q, end, v.x)) || !(q = parseFloat(q, end, v.y)) ||
+                !(q = parseFloat(q, end, v.z))) {
+                error = "bad vertex on line " + std::to_string(line);
+                return false;
+            }
+            positions.push_back(v);
+        }
+        else if (p[0] == 'f') {
+            uint32_t corner[3];
+            int n = 0;
+            const char* q = skipSpaces(p + 1, end);
+            while (q < end && *q != '\n' && *q != '#') {
+                long long index;
+                auto result = std::from_chars(q, end, index);
+                if (result.ec != std::errc()) {
+                    error = "bad face on line " + std::to_string(line);
+                    return false;
+                }
+                if (index < 0)
+                    index += (long long)positions.size();
+                else
+                    index -= 1;
+                if (index < 0 || index >= (long long)positions.size()) {
+                    error = "vertex index out of range on line " +
+                            std::to_string(line);
+                    return false;
+                }
+                // only the position of "v/vt/vn" is used
+                q = result.ptr;
+                while (q < end && !isSpace(*q) && *q != '\n')
+                    ++q;
+                q = skipSpaces(q, end);
+
+                if (n < 3) {
+                    corner[n++] = (uint32_t)index;
+                    if (n < 3)
+                        continue;
+                }
+                else {
+                    corner[1] = corner[2];
+                    corner[2] = (uint32_t)index;
+                }
+                indices.insert(indices.end(), corner, corner + 3);
+            }
+        }
+    }
+    mesh.numVertices = (uint32_t)positions.size();
+    mesh.numTriangles = (uint32_t)(indices.size() / 3);
+    mesh.positions = positions.data();
+    mesh.indices = indices.data();
+    return true;
+}
+
+inline bool sourceStamp(const std::string& path, uint64_t& size, int64_t& time)
+{
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+    auto stamp = std::filesystem::last_write_time(path, ec);
+    time = stamp.time_since_epoch().count();
+    return !ec;
+}
+
+// false if the cache is missing, of another version or older than the OBJ
+inline bool mapCache(const std::string& cachePath, uint64_t sourceSize,
+                     int64_t sourceTime, IndexedMesh& mesh)
+{
+    MappedFile file;
+    if (!file.open(cachePath) || file.size() < sizeof(CacheHeader))
+        return false;
+    CacheHeader header;
+    std::copy(file.data(), file.data() + sizeof(header), (char*)&header);
+    const uint64_t expected = sizeof(CacheHeader) +
+                              (uint64_t)header.numVertices * sizeof(Vector3f) +
+                              (uint64_t)header.numTriangles * 3 * sizeof(uint32_t);
+    if (!std::equal(header.magic, header.magic + 4, cacheMagic) ||
+        header.version != cacheVersion || header.sourceSize != sourceSize ||
+        header.sourceTime != sourceTime || file.size() != expected)
+        return false;
+
+    const char* payload = file.data() + sizeof(CacheHeader);
+    mesh.numVertices = header.numVertices;
+    mesh.numTriangles = header.numTriangles;
+    mesh.positions = (const Vector3f*)payload;
+    mesh.indices = (const uint32_t*)(payload + header.numVertices * sizeof(Vector3f));
+    mesh.mapped = std::move(file);
+    return true;
+}
+
+// Written to a temporary file first, so a reader never maps half a cache
+inline bool writeCache(const std::string& cachePath, uint64_t sourceSize,
+                       int64_t sourceTime, const IndexedMesh& mesh)
+{
+    CacheHeader header;
+    std::copy(cacheMagic, cacheMagic + 4, header.magic);
+    header.version = cacheVersion;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.numVertices = mesh.numVertices;
+    header.numTriangles = mesh.numTriangles;
+
+    std::string tmp = cachePath + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+        return false;
+    const size_t nIndices = (size_t)mesh.numTriangles * 3;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(mesh.positions, sizeof(Vector3f), mesh.numVertices, fp) ==
+                  mesh.numVertices &&
+              fwrite(mesh.indices, sizeof(uint32_t), nIndices, fp) == nIndices;
+    ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+    // rename does not replace an existing file on Windows
+    if (ok)
+        std::remove(cachePath.c_str());
+#endif
+    ok = ok && std::rename(tmp.c_str(), cachePath.c_str()) == 0;
+    if (!ok)
+        std::remove(tmp.c_str());
+    return ok;
+}
+
+// The cache of an OBJ in cacheDir, named after the file and a hash of its
+// absolute path so that models with the same name do not share one
+inline std::string cachePath(const std::string& cacheDir,
+                             const std::string& filename)
+{
+    std::error_code ec;
+    std::filesystem::path source = std::filesystem::absolute(filename, ec);
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)std::hash<std::string>()(source.string()));
+    std::filesystem::path name = source.filename();
+    name += std::string("-") + hash + ".mesh";
+    return (std::filesystem::path(cacheDir) / name).string();
+}
+
+} // namespace meshio
+
+#ifdef RAYTRACING_MESH_CACHE_DIR
+inline const std::string defaultMeshCacheDir = RAYTRACING_MESH_CACHE_DIR;
+#else
+inline const std::string defaultMeshCacheDir;
+#endif
+
+// Loads filename into mesh. Unless cacheDir is empty, its binary cache there
+// is used when it is up to date, and otherwise rebuilt after parsing; a
+// directory that cannot be written to only costs the parse next time.
+inline bool loadMesh(const std::string& filename, IndexedMesh& mesh,
+                     const std::string& cacheDir = defaultMeshCacheDir)
+{
+    mesh = IndexedMesh();
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!meshio::sourceStamp(filename, sourceSize, sourceTime)) {
+        fprintf(stderr, "cannot open mesh %s\n", filename.c_str());
+        return false;
+    }
+    const bool useCache = !cacheDir.empty();
+    const std::string cachePath =
+        useCache ? meshio::cachePath(cacheDir, filename) : std::string();
+    if (useCache && meshio::mapCache(cachePath, sourceSize, sourceTime, mesh))
+        return true;
+
+    MappedFile file;
+    std::string error = "cannot read file";
+    if (!file.open(filename) ||
+        !meshio::parseObj(file.data(), file.data() + file.size(), mesh, error)) {
+        fprintf(stderr, "cannot load mesh %s: %s\n", filename.c_str(),
+                error.c_str());
+        mesh = IndexedMesh();
+        return false;
+    }
+    if (useCache) {
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+    }
+    if (useCache && !meshio::writeCache(cachePath, sourceSize, sourceTime, mesh))
+        fprintf(stderr, "cannot write mesh cache %s\n", cachePath.c_str());
+    return true;
+}
+
+#endif // RAYTRACING_MESHLOADER_H
@@ -0,0 +1,68 @@
+//
+// Counters of the work done while rendering. Every thread counts into its
+// own RayStats, the renderer adds them up when the workers are done, so
+// counting is a plain increment. Defining RAYTRACING_NO_STATS compiles the
+// counting out.
+//
+
+#ifndef RAYTRACING_RAYSTATS_H
+#define RAYTRACING_RAYSTATS_H
+
+#include <cstdint>
+
+#ifdef RAYTRACING_NO_STATS
+constexpr bool statsEnabled = false;
+#else
+constexpr bool statsEnabled = true;
+#endif
+
+enum RayType { CameraRay, IndirectRay, ShadowRay, NumRayTypes };
+
+struct RayStats
+{
+    // paths of this many rays or more share the last bin
+    static constexpr int maxPathLength = 32;
+
+    int64_t rays[NumRayTypes] = {};
+    int64_t nodesVisited = 0;     // BVH nodes whose children were tested
+    int64_t primitiveTests = 0;   // primitives in the leaves that were reached
+    int64_t pathLengths[maxPathLength + 1] = {};  // camera + indirect rays
+    // rays traced so far on the path being followed
+    int pathRays = 0;
+
+    void addPath(int length)
+    {
+        ++pathLengths[length < maxPathLength ? length : maxPathLength];
+    }
+
+    void add(const RayStats& other)
+    {
+        for (int t = 0; t < NumRayTypes; ++t)
+            rays[t] += other.rays[t];
+        nodesVisited += other.nodesVisited;
+        primitiveTests += other.primitiveTests;
+        for (int i = 0; i <= maxPathLength; ++i)
+            pathLengths[i] += other.pathLengths[i];
+    }
+};
+
+// counters of the calling thread
+inline RayStats& rayStats()
+{
+    thread_local RayStats stats;
+    return stats;
+}
+
+// Counts the nodes of one traversal locally and adds them to the thread's
+// counters on the way out, whichever return is taken
+struct NodeCounter
+{
+    int64_t n = 0;
+    ~NodeCounter()
+    {
+        if (statsEnabled)
+            rayStats().nodesVisited += n;
+    }
+};
+
+#endif // RAYTRACING_RAYSTATS_H
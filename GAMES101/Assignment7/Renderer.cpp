@@ -3,6 +3,12 @@
 //
 
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include "Scene.hpp"
 #include "Renderer.hpp"
 
@@ -11,47 +17,416 @@ inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
 
 const float EPSILON = 0.00001;
 
-// The main render function. This where we iterate over all pixels in the image,
-// generate primary rays and cast these rays into the scene. The content of the
-// framebuffer is saved to a file.
-void Renderer::Render(const Scene& scene)
+// Tiles owned by one worker. The owner pops from the front, idle workers
+// steal from the back so they take the tiles the owner would reach last.
+struct TileQueue
+{
+    std::mutex mutex;
+    std::deque<int> tiles;
+};
+
+static bool popTile(std::vector<TileQueue>& queues, int self, int& tile)
 {
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
+    {
+        std::lock_guard<std::mutex> lock(queues[self].mutex);
+        if (!queues[self].tiles.empty()) {
+            tile = queues[self].tiles.front();
+            queues[self].tiles.pop_front();
+            return true;
+        }
+    }
+    // own queue is drained, try to steal from the others
+    for (int k = 1; k < (int)queues.size(); ++k) {
+        TileQueue& victim = queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+    // tiles are never added after the start, so nothing is left anywhere
+    return false;
+}
 
+// direction of the camera ray through the center of pixel (i, j)
+Vector3f Renderer::PrimaryDirection(const Scene& scene, int i, int j) const
+{
     float scale = tan(deg2rad(scene.fov * 0.5));
     float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
+    float x = (2 * (i + 0.5) / (float)scene.width - 1) *
+              imageAspectRatio * scale;
+    float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
+    return normalize(Vector3f(-x, y, 1));
+}
+
+void Renderer::RenderTile(const Scene& scene, const Tile& tile,
+                          int firstSample, int nSamples,
+                          std::vector<Vector3f>& tileBuffer) const
+{
     int m = 0;
 
-    // change the spp value to change sample ammount
-    int spp = 16;
-    std::cout << "SPP: " << spp << "\n";
-    for (uint32_t j = 0; j < scene.height; ++j) {
-        for (uint32_t i = 0; i < scene.width; ++i) {
-            // generate primary ray direction
-            float x = (2 * (i + 0.5) / (float)scene.width - 1) *
-                      imageAspectRatio * scale;
-            float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
+    // every pixel sample reseeds the sampler, so the thread doesn't matter
+    Sampler& sampler = get_sampler();
+    sampler.type = samplerType;
 
-            Vector3f dir = normalize(Vector3f(-x, y, 1));
-            for (int k = 0; k < spp; k++){
-                framebuffer[m] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
+    for (int j = tile.y0; j < tile.y1; ++j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+            // generate primary ray direction
+            Vector3f dir = PrimaryDirection(scene, i, j);
+            Vector3f color;
+            for (int k = firstSample; k < firstSample + nSamples; k++){
+                sampler.startPixelSample(seed, j * scene.width + i, k);
+                color += scene.castRay(Ray(eye_pos, dir), 0) / nSamples;
+                if (statsEnabled)
+                    rayStats().addPath(rayStats().pathRays);
             }
-            m++;
+            tileBuffer[m++] = color;
         }
-        UpdateProgress(j / (float)scene.height);
     }
-    UpdateProgress(1.f);
+}
 
+// Sum of the pass averages of every pixel, together with the sums over the
+// passes of their luminance and its square, from which the variance of each
+// pixel's estimate follows. All pixels always have the same sample count.
+struct AccumulationBuffer
+{
+    int width, height;
+    uint32_t seed;
+    // a checkpoint only continues the estimate it was started with
+    SamplerType sampler;
+    RenderMode mode;
+    int samples = 0, passes = 0;
+    std::vector<Vector3f> sum;
+    std::vector<float> lumSum, lumSqSum;
+
+    AccumulationBuffer(int w, int h, uint32_t seed, SamplerType sampler,
+                       RenderMode mode)
+        : width(w), height(h), seed(seed), sampler(sampler), mode(mode),
+          sum(w * h), lumSum(w * h), lumSqSum(w * h)
+    {}
+
+    void add(const std::vector<Vector3f>& pass, int nSamples)
+    {
+        for (int i = 0; i < width * height; ++i) {
+            sum[i] += pass[i] * nSamples;
+            float lum = 0.2126f * pass[i].x + 0.7152f * pass[i].y +
+                        0.0722f * pass[i].z;
+            lumSum[i] += lum;
+            lumSqSum[i] += lum * lum;
+        }
+        samples += nSamples;
+        ++passes;
+    }
+
+    // largest variance of a pixel's mean luminance, estimated from the spread
+    // of the pass averages, so it needs two passes
+    float maxVariance() const
+    {
+        if (passes < 2)
+            return std::numeric_limits<float>::max();
+        float worst = 0;
+        for (int i = 0; i < width * height; ++i) {
+            float mean = lumSum[i] / passes;
+            float var = (lumSqSum[i] / passes - mean * mean) * passes /
+                        (passes - 1);
+            worst = std::max(worst, var / passes);
+        }
+        return worst;
+    }
+
+    std::vector<Vector3f> average() const
+    {
+        std::vector<Vector3f> image(width * height);
+        for (int i = 0; i < width * height; ++i)
+            image[i] = sum[i] / std::max(samples, 1);
+        return image;
+    }
+
+    // Written to a temporary file first, so a crash while saving leaves the
+    // previous checkpoint in place.
+    bool save(const std::string& path) const
+    {
+        std::string tmp = path + ".tmp";
+        FILE* fp = fopen(tmp.c_str(), "wb");
+        if (!fp)
+            return false;
+        const int32_t header[8] = {checkpointVersion, width, height,
+                                   (int32_t)seed, (int32_t)sampler,
+                                   (int32_t)mode, samples, passes};
+        bool ok = fwrite(checkpointMagic, 1, 4, fp) == 4 &&
+                  fwrite(header, sizeof(header), 1, fp) == 1 &&
+                  fwrite(sum.data(), sizeof(Vector3f), sum.size(), fp) == sum.size() &&
+                  fwrite(lumSum.data(), sizeof(float), lumSum.size(), fp) == lumSum.size() &&
+                  fwrite(lumSqSum.data(), sizeof(float), lumSqSum.size(), fp) == lumSqSum.size();
+        ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows
+        if (ok)
+            std::remove(path.c_str());
+#endif
+        return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // false if there is no checkpoint or it belongs to another image, seed,
+    // sampler or render mode
+    bool load(const std::string& path)
+    {
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (!fp)
+            return false;
+        char magic[4];
+        int32_t header[8];
+        bool ok = fread(magic, 1, 4, fp) == 4 &&
+                  std::equal(magic, magic + 4, checkpointMagic) &&
+                  fread(header, sizeof(header), 1, fp) == 1 &&
+                  header[0] == checkpointVersion && header[1] == width &&
+                  header[2] == height && header[3] == (int32_t)seed &&
+                  header[4] == (int32_t)sampler && header[5] == (int32_t)mode &&
+                  fread(sum.data(), sizeof(Vector3f), sum.size(), fp) == sum.size() &&
+                  fread(lumSum.data(), sizeof(float), lumSum.size(), fp) == lumSum.size() &&
+                  fread(lumSqSum.data(), sizeof(float), lumSqSum.size(), fp) == lumSqSum.size();
+        fclose(fp);
+        if (ok) {
+            samples = header[6];
+            passes = header[7];
+        }
+        else {
+            *this = AccumulationBuffer(width, height, seed, sampler, mode);
+        }
+        return ok;
+    }
+
+    static constexpr char checkpointMagic[4] = {'A', '7', 'C', 'K'};
+    static constexpr int32_t checkpointVersion = 2;
+};
+
+static void WriteImage(const std::vector<Vector3f>& framebuffer, int width,
+                       int height)
+{
     // save framebuffer to file
     FILE* fp = fopen("binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
+    (void)fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    for (auto i = 0; i < height * width; ++i) {
         static unsigned char color[3];
         color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
         color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
         color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
         fwrite(color, 1, 3, fp);
     }
-    fclose(fp);    
+    fclose(fp);
+}
+
+// Seconds spent in each part of Render, summed over the passes
+struct RenderTimes
+{
+    double render = 0, accumulate = 0, checkpoint = 0, writeImage = 0;
+};
+
+// samples are the ones traced by this run, which the rays and times cover;
+// resumedSamples came from a checkpoint.
+static void WriteStats(const std::string& path, const Renderer& r,
+                       const Scene& scene, int threads, int samples,
+                       int resumedSamples, const RayStats& rays, const WavefrontStats& wavefront,
+                       const RenderTimes& times)
+{
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        std::cout << "Could not write statistics " << path << "\n";
+        return;
+    }
+    int64_t total = rays.rays[CameraRay] + rays.rays[IndirectRay] + rays.rays[ShadowRay];
+    int64_t paths = 0, pathRays = 0;
+    for (int i = 0; i <= RayStats::maxPathLength; ++i) {
+        paths += rays.pathLengths[i];
+        pathRays += rays.pathLengths[i] * i;
+    }
+    auto perRay = [&](int64_t n) { return total > 0 ? (double)n / total : 0.0; };
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"mode\": \"%s\",\n",
+            r.mode == RenderMode::Wavefront ? "wavefront" : "recursive");
+    fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n", scene.width, scene.height);
+    fprintf(fp, "  \"spp\": %d,\n  \"resumed_spp\": %d,\n  \"threads\": %d,\n",
+            samples, resumedSamples, threads);
+    fprintf(fp, "  \"rays\": {\"camera\": %lld, \"indirect\": %lld, "
+                "\"shadow\": %lld, \"total\": %lld},\n",
+            (long long)rays.rays[CameraRay], (long long)rays.rays[IndirectRay],
+            (long long)rays.rays[ShadowRay], (long long)total);
+    fprintf(fp, "  \"rays_per_second\": %.0f,\n",
+            times.render > 0 ? total / times.render : 0.0);
+    fprintf(fp, "  \"bvh\": {\"nodes_visited\": %lld, \"primitive_tests\": %lld, "
+                "\"nodes_per_ray\": %.3f, \"tests_per_ray\": %.3f},\n",
+            (long long)rays.nodesVisited, (long long)rays.primitiveTests,
+            perRay(rays.nodesVisited), perRay(rays.primitiveTests));
+    fprintf(fp, "  \"paths\": {\"count\": %lld, \"mean_length\": %.4f, "
+                "\"length_histogram\": [",
+            (long long)paths, paths > 0 ? (double)pathRays / paths : 0.0);
+    for (int i = 0; i <= RayStats::maxPathLength; ++i)
+        fprintf(fp, "%s%lld", i ? ", " : "", (long long)rays.pathLengths[i]);
+    fprintf(fp, "]},\n");
+    fprintf(fp, "  \"seconds\": {\"render\": %.4f, \"accumulate\": %.4f, "
+                "\"checkpoint\": %.4f, \"write_image\": %.4f",
+            times.render, times.accumulate, times.checkpoint, times.writeImage);
+    if (r.mode == RenderMode::Wavefront) {
+        // summed over the threads
+        const char* names[NumStages] = {"generate", "extend", "shade", "shadow"};
+        fprintf(fp, ",\n    \"wavefront\": {");
+        for (int s = 0; s < NumStages; ++s)
+            fprintf(fp, "%s\"%s\": {\"rays\": %lld, \"seconds\": %.4f}",
+                    s ? ", " : "", names[s], (long long)wavefront.rays[s],
+                    wavefront.seconds[s]);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "}\n}\n");
+    fclose(fp);
+}
+
+// Renders samples [firstSample, firstSample + nSamples) of every pixel and
+// stores their average in framebuffer.
+//
+// The image is cut into tiles which are spread over the worker threads. Each
+// worker renders into its own tile buffer and copies the finished tile into
+// the framebuffer, tiles never overlap so no locking is needed there.
+void Renderer::RenderPass(const Scene& scene, const std::vector<Tile>& tiles,
+                          int threadCount, int firstSample, int nSamples,
+                          std::vector<Vector3f>& framebuffer,
+                          WavefrontStats& stats, RayStats& rayTotals) const
+{
+    // hand each worker a contiguous run of tiles, stealing evens out the rest
+    std::vector<TileQueue> queues(threadCount);
+    for (int t = 0; t < (int)tiles.size(); ++t)
+        queues[(int64_t)t * threadCount / tiles.size()].tiles.push_back(t);
+
+    std::atomic<int> tilesDone(0);
+    std::mutex progressMutex;
+
+    auto worker = [&](int self) {
+        std::vector<Vector3f> tileBuffer(tileSize * tileSize);
+        WavefrontStats workerStats;
+        int t;
+        while (popTile(queues, self, t)) {
+            const Tile& tile = tiles[t];
+            if (mode == RenderMode::Wavefront)
+                RenderTileWavefront(scene, tile, firstSample, nSamples,
+                                    tileBuffer, workerStats);
+            else
+                RenderTile(scene, tile, firstSample, nSamples, tileBuffer);
+
+            int w = tile.x1 - tile.x0;
+            for (int j = tile.y0; j < tile.y1; ++j)
+                std::copy(tileBuffer.begin() + (j - tile.y0) * w,
+                          tileBuffer.begin() + (j - tile.y0 + 1) * w,
+                          framebuffer.begin() + j * scene.width + tile.x0);
+
+            int done = ++tilesDone;
+            std::lock_guard<std::mutex> lock(progressMutex);
+            UpdateProgress((firstSample + nSamples * done / (float)tiles.size()) / spp);
+        }
+        std::lock_guard<std::mutex> lock(progressMutex);
+        stats.add(workerStats);
+        // the thread's counters start over for the next pass
+        rayTotals.add(rayStats());
+        rayStats() = RayStats();
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; ++i)
+        threads.emplace_back(worker, i);
+    worker(0);
+    for (auto& th : threads)
+        th.join();
+}
+
+// The main render function. This where we iterate over all pixels in the image,
+// generate primary rays and cast these rays into the scene. The content of the
+// framebuffer is saved to a file.
+void Renderer::Render(const Scene& scene)
+{
+    int threadCount = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+    threadCount = std::max(1, threadCount);
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < scene.height; y += tileSize) {
+        for (int x = 0; x < scene.width; x += tileSize) {
+            tiles.push_back({x, y, std::min(x + tileSize, scene.width),
+                             std::min(y + tileSize, scene.height)});
+        }
+    }
+
+    AccumulationBuffer accumulation(scene.width, scene.height, seed,
+                                    samplerType, mode);
+    bool checkpoints = progressive && !checkpointPath.empty();
+    if (checkpoints && accumulation.load(checkpointPath))
+        std::cout << "Resuming from " << checkpointPath << " at "
+                  << accumulation.samples << " spp\n";
+    const int resumedSamples = accumulation.samples;
+
+    std::cout << "SPP: " << spp << ", threads: " << threadCount << "\n";
+    WavefrontStats stats;
+    // counting starts here, whatever the calling thread traced before
+    rayStats() = RayStats();
+    RayStats rayTotals;
+    RenderTimes times;
+    std::vector<Vector3f> pass(scene.width * scene.height);
+    // a plain render is a single pass over all samples
+    const int passSize = progressive ? std::max(1, passSpp) : spp;
+    auto start = std::chrono::steady_clock::now();
+    auto lastCheckpoint = start;
+    auto secondsSince = [](std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    };
+
+    while (accumulation.samples < spp) {
+        int n = std::min(passSize, spp - accumulation.samples);
+        auto stageStart = std::chrono::steady_clock::now();
+        RenderPass(scene, tiles, threadCount, accumulation.samples, n, pass,
+                   stats, rayTotals);
+        times.render += secondsSince(stageStart);
+        stageStart = std::chrono::steady_clock::now();
+        accumulation.add(pass, n);
+        times.accumulate += secondsSince(stageStart);
+        if (!progressive)
+            continue;
+
+        bool done = accumulation.samples >= spp ||
+                    (timeBudget > 0 && secondsSince(start) >= timeBudget) ||
+                    (varianceTarget > 0 &&
+                     accumulation.maxVariance() <= varianceTarget);
+        if (checkpoints &&
+            (done || secondsSince(lastCheckpoint) >= checkpointInterval)) {
+            auto stageStart = std::chrono::steady_clock::now();
+            if (!accumulation.save(checkpointPath))
+                std::cout << "\nCould not write checkpoint " << checkpointPath << "\n";
+            // the image on disk follows the checkpoint
+            WriteImage(accumulation.average(), scene.width, scene.height);
+            lastCheckpoint = std::chrono::steady_clock::now();
+            times.checkpoint += secondsSince(stageStart);
+        }
+        if (done)
+            break;
+    }
+    UpdateProgress(1.f);
+    if (progressive)
+        std::cout << "\nStopped at " << accumulation.samples << " spp\n";
+
+    if (mode == RenderMode::Wavefront) {
+        // time is summed over the threads, so the rates are per thread
+        const char* names[NumStages] = {"generate", "extend", "shade", "shadow"};
+        std::cout << "\nWavefront stages (per thread):\n";
+        for (int s = 0; s < NumStages; ++s)
+            printf("  %-9s %12lld rays %8.2f Mrays/s\n", names[s],
+                   (long long)stats.rays[s],
+                   stats.seconds[s] > 0 ? stats.rays[s] / stats.seconds[s] * 1e-6 : 0.0);
+    }
+
+    auto stageStart = std::chrono::steady_clock::now();
+    WriteImage(progressive ? accumulation.average() : pass, scene.width,
+               scene.height);
+    times.writeImage = secondsSince(stageStart);
+
+    if (!statsPath.empty())
+        WriteStats(statsPath, *this, scene, threadCount,
+                   accumulation.samples - resumedSamples, resumedSamples,
+                   rayTotals, stats, times);
 }
@@ -1,7 +1,9 @@
 //
 // Created by goksu on 2/25/20.
 //
+#include <string>
 #include "Scene.hpp"
+#include "Wavefront.hpp"
 
 #pragma once
 struct hit_payload
@@ -12,10 +14,63 @@ struct hit_payload
     Object* hit_obj;
 };
 
+// Recursive runs castRay sample by sample, Wavefront moves all paths of a
+// tile through the generate/extend/shade/shadow stages in batches
+enum class RenderMode { Recursive, Wavefront };
+
+// A square block of the image that is rendered by a single worker
+struct Tile
+{
+    int x0, y0, x1, y1;
+};
+
 class Renderer
 {
 public:
+    // change the spp value to change sample ammount
+    int spp = 16;
+    // number of worker threads, 0 picks std::thread::hardware_concurrency()
+    int numThreads = 0;
+    // width and height of the tiles handed out to the workers, in pixels
+    int tileSize = 16;
+    // the same seed always produces the same image, whatever numThreads is
+    uint32_t seed = 0;
+    // Independent draws PCG32 numbers, Halton a low-discrepancy sequence
+    SamplerType samplerType = SamplerType::Independent;
+    RenderMode mode = RenderMode::Recursive;
+    // the camera sits here and looks down +z
+    Vector3f eye_pos = Vector3f(278, 273, -800);
+
+    // Progressive mode renders passes of passSpp samples into an accumulation
+    // buffer. It stops at spp samples, when timeBudget seconds are used up or
+    // when the variance of every pixel's luminance estimate is below
+    // varianceTarget, 0 disables either limit.
+    bool progressive = false;
+    int passSpp = 1;
+    double timeBudget = 0;
+    float varianceTarget = 0;
+    // progressive mode saves the accumulation buffer here every
+    // checkpointInterval seconds and after the last pass, and a checkpoint
+    // of the same image, seed, sampler and mode found there at the start is
+    // resumed
+    std::string checkpointPath;
+    double checkpointInterval = 60;
+    // ray counts, traversal work, path lengths and stage times of the last
+    // render are written here as JSON, nothing is written when empty
+    std::string statsPath;
+
     void Render(const Scene& scene);
 
 private:
+    Vector3f PrimaryDirection(const Scene& scene, int i, int j) const;
+    void RenderPass(const Scene& scene, const std::vector<Tile>& tiles,
+                    int threadCount, int firstSample, int nSamples,
+                    std::vector<Vector3f>& framebuffer,
+                    WavefrontStats& stats, RayStats& rayTotals) const;
+    void RenderTile(const Scene& scene, const Tile& tile, int firstSample,
+                    int nSamples, std::vector<Vector3f>& tileBuffer) const;
+    void RenderTileWavefront(const Scene& scene, const Tile& tile,
+                             int firstSample, int nSamples,
+                             std::vector<Vector3f>& tileBuffer,
+                             WavefrontStats& stats) const;
 };
@@ -5,35 +5,74 @@
 #include "Scene.hpp"
 
 
+static float luminance(const Vector3f &c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 void Scene::buildBVH() {
     printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    delete this->bvh;
+    this->bvh = new BVHAccel(objects, 1, splitMethod, bvhLayout);
+    buildLightTable();
 }
 
-Intersection Scene::intersect(const Ray &ray) const
+void Scene::refitBVH()
 {
-    return this->bvh->Intersect(ray);
+    bvh->refit();
+    buildLightTable();
 }
 
-void Scene::sampleLight(Intersection &pos, float &pdf) const
+void Scene::buildLightTable()
 {
-    float emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
+    // the power of a diffuse emitter is pi * area * Le, pi cancels out
+    std::vector<float> power;
+    emitters.clear();
+    totalLightPower = 0;
+    for (auto object : objects) {
+        if (object->hasEmit()) {
+            Intersection pos;
+            float pdf;
+            object->Sample(pos, pdf);
+            emitters.push_back(object);
+            power.push_back(object->getArea() * luminance(pos.emit));
+            totalLightPower += power.back();
         }
     }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-            if (p <= emit_area_sum){
-                objects[k]->Sample(pos, pdf);
-                break;
-            }
-        }
+    // without light power there is nothing to sample, an empty table says so
+    lightTable = totalLightPower > 0 ? AliasTable(power) : AliasTable();
+}
+
+Intersection Scene::intersect(const Ray &ray, RayType type) const
+{
+    if (statsEnabled)
+        ++rayStats().rays[type];
+    return this->bvh->Intersect(ray);
+}
+
+bool Scene::intersectP(const Ray &ray) const
+{
+    if (statsEnabled)
+        ++rayStats().rays[ShadowRay];
+    return this->bvh->IntersectP(ray);
+}
+
+void Scene::sampleLight(Intersection &pos, float &pdf) const
+{
+    if (lightTable.size() == 0) {
+        pdf = 0;
+        return;
     }
+    int k = lightTable.sample(get_random_float());
+    emitters[k]->Sample(pos, pdf);
+    pdf *= lightTable.pmf(k);
+}
+
+// Emitters are chosen by area times luminance and sampled uniformly by area,
+// so the pdf of a point only depends on the radiance it emits
+float Scene::lightPdf(const Vector3f &Le) const
+{
+    return totalLightPower > 0 ? luminance(Le) / totalLightPower : 0;
 }
 
 bool Scene::trace(
@@ -58,61 +97,89 @@ bool Scene::trace(
 }
 
 // Implementation of Path Tracing
+// Direct light is gathered twice, by sampling a point on a light and by the
+// BSDF sample hitting an emitter. Both are weighted with the power heuristic
+// so each contributes where its pdf is the better one.
 Vector3f Scene::castRay(const Ray &ray, int depth) const
+{
+    // 从像素发出的光线与物体的交点
+    Intersection obj_inter = intersect(ray, depth == 0 ? CameraRay : IndirectRay);
+    if (statsEnabled && depth == 0)
+        rayStats().pathRays = 1;
+    return castRay(ray, obj_inter, depth);
+}
+
+Vector3f Scene::castRay(const Ray &ray, const Intersection &obj_inter, int depth) const
 {
     // Implement Path Tracing Algorithm here
     Vector3f L_dir;
     Vector3f L_indir;
 
-    // 从像素发出的光线与物体的交点
-    Intersection obj_inter = intersect(ray);
     if (!obj_inter.happened)
         return L_dir;
 
-    // 打到光源
+    // 打到光源，更深的弹射在上一层按MIS加权计入
     if (obj_inter.m->hasEmission())
-        return obj_inter.m->getEmission();
+        return depth == 0 ? obj_inter.m->getEmission() : L_dir;
 
     // 打到物体
     Vector3f p = obj_inter.coords;
     Material* m = obj_inter.m;
-    Vector3f N = obj_inter.normal.normalized();
+    Vector3f N = normalize(obj_inter.normal);
     Vector3f wo = ray.direction; // 像素到物体的向量
 
     // 有交点，对光源采样
     float pdf_L = 1.0; //可以不初始化
     Intersection light_inter;
-    sampleLight(light_inter, pdf_L);    // 得到光源位置和对光源采样的pdf
+    sampleLight(light_inter, pdf_L);    // 得到光源位置和对光源采样的pdf(面积)
 
     Vector3f x = light_inter.coords;
     Vector3f ws = (x - p).normalized(); //物体到光源
     Vector3f NN = light_inter.normal.normalized();
     Vector3f emit = light_inter.emit;
     float d = (x - p).norm();
+    float cos_theta = dotProduct(N, ws);
+    float cos_theta_x = dotProduct(NN, -ws);//ws从物体指向光源，与NN的夹角大于180
 
     // 再次从光源发出一条光线，判断是否能打到该物体，即中间是否有阻挡
+    // 只需知道有没有遮挡，光源本身在t_max之外，需注意浮点数的处理
     Ray Obj2Light(p, ws);
-    float d2 = intersect(Obj2Light).distance;
-    // 是否阻挡，利用距离判断，需注意浮点数的处理
-    if (d2 - d > -0.001) {
+    Obj2Light.t_max = d - 0.001;
+    if (pdf_L > 0 && cos_theta > 0 && cos_theta_x > 0 && !intersectP(Obj2Light)) {
         Vector3f eval = m->eval(wo, ws, N); // wo不会用到
-        float cos_theta = dotProduct(N, ws);
-        float cos_theta_x = dotProduct(NN, -ws);//ws从物体指向光源，与NN的夹角大于180
-        L_dir = emit * eval * cos_theta * cos_theta_x / std::pow(d, 2) / pdf_L;
+        // 面积pdf换算成立体角pdf，才能与BSDF的pdf比较
+        float pdf_light = pdf_L * d * d / cos_theta_x;
+        float weight = powerHeuristic(pdf_light, m->pdf(wo, ws, N));
+        L_dir = emit * eval * cos_theta / pdf_light * weight;
     }
 
     // L_indir
     float P_RR = get_random_float();
     if (P_RR < RussianRoulette) {
         Vector3f wi = m->sample(wo, N).normalized();
+        float pdf_O = m->pdf(wo, wi, N);
         Ray r(p, wi);
         Intersection inter = intersect(r);
-        // 判断打到的物体是否会发光取决于m
-        if (inter.happened && !inter.m->hasEmission()) {
+        if (statsEnabled)
+            ++rayStats().pathRays;
+        if (inter.happened && pdf_O > 0) {
             Vector3f eval = m->eval(wo, wi, N);
-            float pdf_O = m->pdf(wo, wi, N);
             float cos_theta = dotProduct(wi, N);
-            L_indir = castRay(r, depth + 1) * eval * cos_theta / pdf_O / RussianRoulette;
+            Vector3f f = eval * cos_theta / pdf_O / RussianRoulette;
+            if (inter.m->hasEmission()) {
+                // BSDF采样打到光源，权重使用光源采样到同一点的pdf
+                float cos_light = dotProduct(inter.normal, -wi);
+                if (cos_light > 0) {
+                    float pdf_light = lightPdf(inter.m->getEmission()) *
+                                      inter.distance * inter.distance / cos_light;
+                    L_dir += inter.m->getEmission() * f *
+                             powerHeuristic(pdf_O, pdf_light);
+                }
+            }
+            else {
+                // 交点已经求出，下一层不再重复求交
+                L_indir = castRay(r, inter, depth + 1) * f;
+            }
         }
     }
     //4->16min
@@ -9,6 +9,7 @@
 #include "Object.hpp"
 #include "Light.hpp"
 #include "AreaLight.hpp"
+#include "AliasTable.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
 
@@ -20,6 +21,10 @@ public:
     int width = 1280;
     int height = 960;
     double fov = 40;
+    // how the scene BVH is split and laid out, meshes pick theirs in
+    // MeshTriangle
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
+    BVHAccel::Layout bvhLayout = BVHAccel::Layout::BINARY;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 1;
     float RussianRoulette = 0.8;
@@ -32,11 +37,26 @@ public:
 
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
-    Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
+    // closest hit, counted in the ray statistics as a ray of the given type
+    Intersection intersect(const Ray& ray, RayType type = IndirectRay) const;
+    // true if anything blocks the ray before ray.t_max, counted as a shadow ray
+    bool intersectP(const Ray& ray) const;
+    BVHAccel *bvh = nullptr;
+    // (Re)builds the scene BVH over the objects. Meshes keep their own BVH,
+    // so after moving instances only this top level is built again.
     void buildBVH();
+    // Refits the scene BVH after objects moved or changed shape, it is only
+    // rebuilt when its quality dropped too far. The light table follows.
+    void refitBVH();
     Vector3f castRay(const Ray &ray, int depth) const;
+    // shades the ray's closest hit found by the caller, the bounces pass
+    // their hit down so every ray is traced once
+    Vector3f castRay(const Ray &ray, const Intersection &hit, int depth) const;
+    // picks an emitter in proportion to its power and a point uniformly on
+    // it, pdf is per unit area
     void sampleLight(Intersection &pos, float &pdf) const;
+    // the pdf sampleLight has for a point on a surface emitting Le
+    float lightPdf(const Vector3f &Le) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -46,6 +66,11 @@ public:
     // creating the scene (adding objects and lights)
     std::vector<Object* > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    // emitting objects and the alias table over their power, set up in buildBVH
+    std::vector<Object*> emitters;
+    AliasTable lightTable;
+    float totalLightPower = 0;
+    void buildLightTable();
 
     // Compute reflection direction
     Vector3f reflect(const Vector3f &I, const Vector3f &N) const
@@ -24,11 +24,10 @@ public:
         float b = 2 * dotProduct(ray.direction, L);
         float c = dotProduct(L, L) - radius2;
         float t0, t1;
-        float area = 4 * M_PI * radius2;
         if (!solveQuadratic(a, b, c, t0, t1)) return false;
         if (t0 < 0) t0 = t1;
         if (t0 < 0) return false;
-        return true;
+        return t0 <= ray.t_max;
     }
     bool intersect(const Ray& ray, float &tnear, uint32_t &index) const
     {
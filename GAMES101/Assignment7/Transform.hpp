@@ -0,0 +1,192 @@
+//
+// 4x4 transforms of points, vectors, normals and boxes. The inverse is kept
+// alongside the matrix, instances need both on every ray.
+//
+
+#ifndef RAYTRACING_TRANSFORM_H
+#define RAYTRACING_TRANSFORM_H
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include "Bounds3.hpp"
+#include "Vector.hpp"
+
+class Transform
+{
+public:
+    float m[4][4];
+    float inv[4][4];
+
+    Transform()
+    {
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = inv[i][j] = i == j ? 1.f : 0.f;
+    }
+
+    // row major, points are column vectors: p' = mat * p
+    explicit Transform(const float mat[4][4])
+    {
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = mat[i][j];
+        invert(m, inv);
+    }
+
+    static Transform translate(const Vector3f& d)
+    {
+        const float mat[4][4] = {{1, 0, 0, d.x},
+                                 {0, 1, 0, d.y},
+                                 {0, 0, 1, d.z},
+                                 {0, 0, 0, 1}};
+        return Transform(mat);
+    }
+
+    static Transform scale(const Vector3f& s)
+    {
+        const float mat[4][4] = {{s.x, 0, 0, 0},
+                                 {0, s.y, 0, 0},
+                                 {0, 0, s.z, 0},
+                                 {0, 0, 0, 1}};
+        return Transform(mat);
+    }
+
+    // counter-clockwise around axis when looking against it
+    static Transform rotate(float degrees, const Vector3f& axis)
+    {
+        Vector3f a = normalize(axis);
+        float theta = degrees * M_PI / 180.f;
+        float s = std::sin(theta), c = std::cos(theta);
+        const float mat[4][4] = {
+            {a.x * a.x + (1 - a.x * a.x) * c, a.x * a.y * (1 - c) - a.z * s,
+             a.x * a.z * (1 - c) + a.y * s, 0},
+            {a.x * a.y * (1 - c) + a.z * s, a.y * a.y + (1 - a.y * a.y) * c,
+             a.y * a.z * (1 - c) - a.x * s, 0},
+            {a.x * a.z * (1 - c) - a.y * s, a.y * a.z * (1 - c) + a.x * s,
+             a.z * a.z + (1 - a.z * a.z) * c, 0},
+            {0, 0, 0, 1}};
+        return Transform(mat);
+    }
+
+    // applies t first, then *this
+    Transform operator*(const Transform& t) const
+    {
+        float mat[4][4];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                mat[i][j] = m[i][0] * t.m[0][j] + m[i][1] * t.m[1][j] +
+                            m[i][2] * t.m[2][j] + m[i][3] * t.m[3][j];
+        return Transform(mat);
+    }
+
+    Transform inverse() const
+    {
+        Transform t;
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j) {
+                t.m[i][j] = inv[i][j];
+                t.inv[i][j] = m[i][j];
+            }
+        return t;
+    }
+
+    Vector3f point(const Vector3f& p) const { return applyPoint(m, p); }
+    Vector3f vector(const Vector3f& v) const { return applyVector(m, v); }
+    // normals go through the inverse transpose, the result is not normalized
+    Vector3f normal(const Vector3f& n) const
+    {
+        return Vector3f(inv[0][0] * n.x + inv[1][0] * n.y + inv[2][0] * n.z,
+                        inv[0][1] * n.x + inv[1][1] * n.y + inv[2][1] * n.z,
+                        inv[0][2] * n.x + inv[1][2] * n.y + inv[2][2] * n.z);
+    }
+    Vector3f inversePoint(const Vector3f& p) const { return applyPoint(inv, p); }
+    Vector3f inverseVector(const Vector3f& v) const { return applyVector(inv, v); }
+
+    // box around the eight transformed corners
+    Bounds3 bounds(const Bounds3& b) const
+    {
+        Bounds3 ret;
+        for (int corner = 0; corner < 8; ++corner) {
+            Vector3f p((corner & 1 ? b.pMax : b.pMin).x,
+                       (corner & 2 ? b.pMax : b.pMin).y,
+                       (corner & 4 ? b.pMax : b.pMin).z);
+            ret = Union(ret, point(p));
+        }
+        return ret;
+    }
+
+    // determinant of the linear part, the volume scale
+    float determinant() const
+    {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+               m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // whether the linear part is a rotation or reflection times a uniform
+    // scale, which scales every area by the same factor
+    bool isSimilarity(float tolerance = 1e-4f) const
+    {
+        Vector3f x = vector(Vector3f(1, 0, 0)), y = vector(Vector3f(0, 1, 0)),
+                 z = vector(Vector3f(0, 0, 1));
+        float s = dotProduct(x, x);
+        return std::fabs(dotProduct(y, y) - s) <= tolerance * s &&
+               std::fabs(dotProduct(z, z) - s) <= tolerance * s &&
+               std::fabs(dotProduct(x, y)) <= tolerance * s &&
+               std::fabs(dotProduct(y, z)) <= tolerance * s &&
+               std::fabs(dotProduct(z, x)) <= tolerance * s;
+    }
+
+private:
+    static Vector3f applyPoint(const float a[4][4], const Vector3f& p)
+    {
+        float x = a[0][0] * p.x + a[0][1] * p.y + a[0][2] * p.z + a[0][3];
+        float y = a[1][0] * p.x + a[1][1] * p.y + a[1][2] * p.z + a[1][3];
+        float z = a[2][0] * p.x + a[2][1] * p.y + a[2][2] * p.z + a[2][3];
+        float w = a[3][0] * p.x + a[3][1] * p.y + a[3][2] * p.z + a[3][3];
+        return w == 1 ? Vector3f(x, y, z) : Vector3f(x, y, z) / w;
+    }
+
+    static Vector3f applyVector(const float a[4][4], const Vector3f& v)
+    {
+        return Vector3f(a[0][0] * v.x + a[0][1] * v.y + a[0][2] * v.z,
+                        a[1][0] * v.x + a[1][1] * v.y + a[1][2] * v.z,
+                        a[2][0] * v.x + a[2][1] * v.y + a[2][2] * v.z);
+    }
+
+    // Gauss-Jordan elimination with partial pivoting, in double
+    static void invert(const float a[4][4], float out[4][4])
+    {
+        double l[4][8];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j) {
+                l[i][j] = a[i][j];
+                l[i][j + 4] = i == j ? 1 : 0;
+            }
+        for (int col = 0; col < 4; ++col) {
+            int pivot = col;
+            for (int r = col + 1; r < 4; ++r)
+                if (std::fabs(l[r][col]) > std::fabs(l[pivot][col]))
+                    pivot = r;
+            if (l[pivot][col] == 0)
+                throw std::runtime_error("singular transform");
+            std::swap(l[col], l[pivot]);
+            double s = 1 / l[col][col];
+            for (int j = 0; j < 8; ++j)
+                l[col][j] *= s;
+            for (int r = 0; r < 4; ++r) {
+                if (r == col || l[r][col] == 0)
+                    continue;
+                double f = l[r][col];
+                for (int j = 0; j < 8; ++j)
+                    l[r][j] -= f * l[col][j];
+            }
+        }
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                out[i][j] = (float)l[i][j + 4];
+    }
+};
+
+#endif // RAYTRACING_TRANSFORM_H
@@ -3,11 +3,12 @@
 #include "BVH.hpp"
 #include "Intersection.hpp"
 #include "Material.hpp"
-#include "OBJ_Loader.hpp"
+#include "MeshLoader.hpp"
 #include "Object.hpp"
 #include "Triangle.hpp"
-#include <cassert>
 #include <array>
+#include <cassert>
+#include <stdexcept>
 
 bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
                           const Vector3f& v2, const Vector3f& orig,
@@ -39,6 +40,37 @@ bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
     return true;
 }
 
+// Moller-Trumbore against the front face of the triangle v0, v0 + e1,
+// v0 + e2 with the given unit normal, t is only set when true is returned
+inline bool triangleHit(const Vector3f& v0, const Vector3f& e1,
+                        const Vector3f& e2, const Vector3f& normal,
+                        const Ray& ray, double& t)
+{
+    if (dotProduct(ray.direction, normal) > 0)
+        return false;
+    double u, v, t_tmp = 0;
+    Vector3f pvec = crossProduct(ray.direction, e2);
+    double det = dotProduct(e1, pvec);
+    if (fabs(det) < EPSILON)
+        return false;
+
+    double det_inv = 1. / det;
+    Vector3f tvec = ray.origin - v0;
+    u = dotProduct(tvec, pvec) * det_inv;
+    if (u < 0 || u > 1)
+        return false;
+    Vector3f qvec = crossProduct(tvec, e1);
+    v = dotProduct(ray.direction, qvec) * det_inv;
+    if (v < 0 || u + v > 1)
+        return false;
+    t_tmp = dotProduct(e2, qvec) * det_inv;
+
+    if (t_tmp < 0)
+        return false;
+    t = t_tmp;
+    return true;
+}
+
 class Triangle : public Object
 {
 public:
@@ -58,9 +90,11 @@ public:
         area = crossProduct(e1, e2).norm()*0.5f;
     }
 
+    // any hit closer than ray.t_max, used for shadow rays
     bool intersect(const Ray& ray) override;
     bool intersect(const Ray& ray, float& tnear,
                    uint32_t& index) const override;
+    bool hit(const Ray& ray, double& t) const;
     Intersection getIntersection(Ray ray) override;
     void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
                               const uint32_t& index, const Vector2f& uv,
@@ -86,67 +120,58 @@ public:
     }
 };
 
-class MeshTriangle : public Object
+// Triangles of an indexed mesh: the vertices are shared, triangle k is
+// vertices[vertexIndex[3k]], [3k + 1] and [3k + 2]. The BVH refers to the
+// triangles by k and keeps the positions it intersects in its own batches.
+class MeshTriangle : public Object, public PrimitiveSet
 {
 public:
-    MeshTriangle(const std::string& filename, Material *mt = new Material())
+    MeshTriangle(const std::string& filename, Material *mt = new Material(),
+                 BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH,
+                 BVHAccel::Layout layout = BVHAccel::Layout::BINARY)
     {
-        objl::Loader loader;
-        loader.LoadFile(filename);
-        area = 0;
+        if (!loadMesh(filename, mesh))
+            throw std::runtime_error("cannot load mesh " + filename);
+        vertices = mesh.positions;
+        vertexIndex = mesh.indices;
+        numTriangles = mesh.numTriangles;
         m = mt;
-        assert(loader.LoadedMeshes.size() == 1);
-        auto mesh = loader.LoadedMeshes[0];
+        updateBounds();
 
-        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity()};
-        Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity()};
-        for (int i = 0; i < mesh.Vertices.size(); i += 3) {
-            std::array<Vector3f, 3> face_vertices;
-
-            for (int j = 0; j < 3; j++) {
-                auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-                                     mesh.Vertices[i + j].Position.Y,
-                                     mesh.Vertices[i + j].Position.Z);
-                face_vertices[j] = vert;
-
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
-            }
-
-            triangles.emplace_back(face_vertices[0], face_vertices[1],
-                                   face_vertices[2], mt);
-        }
+        // leaves of up to one batch, intersected as a whole
+        bvh = new BVHAccel(*this, TriangleBatch::width, splitMethod, layout);
+        bvh->buildTriangleBatches(vertices, vertexIndex);
+    }
 
-        bounding_box = Bounds3(min_vert, max_vert);
+    ~MeshTriangle() { delete bvh; }
 
-        std::vector<Object*> ptrs;
-        for (auto& tri : triangles){
-            ptrs.push_back(&tri);
-            area += tri.area;
-        }
-        bvh = new BVHAccel(ptrs);
+    // Moves the vertices of the mesh, the triangles stay the same. The BVH
+    // is refit, or rebuilt if refitting made it too slow to traverse.
+    // Instances of the mesh see the new bounds after their next setTransform.
+    void setVertices(const std::vector<Vector3f>& positions)
+    {
+        assert(positions.size() == mesh.numVertices);
+        // the indices may still be mapped from the cache, they do not change
+        mesh.ownedPositions = positions;
+        mesh.positions = vertices = mesh.ownedPositions.data();
+        updateBounds();
+        bvh->refit();
+        bvh->buildTriangleBatches(vertices, vertexIndex);
     }
 
-    bool intersect(const Ray& ray) { return true; }
+    // the BVH points back at the mesh
+    MeshTriangle(const MeshTriangle&) = delete;
+    MeshTriangle& operator=(const MeshTriangle&) = delete;
+
+    bool intersect(const Ray& ray) { return bvh->IntersectP(ray); }
 
     bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
     {
         bool intersect = false;
         for (uint32_t k = 0; k < numTriangles; ++k) {
-            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
-            const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
-            const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
             float t, u, v;
-            if (rayTriangleIntersect(v0, v1, v2, ray.origin, ray.direction, t,
-                                     u, v) &&
+            if (rayTriangleIntersect(vertex(k, 0), vertex(k, 1), vertex(k, 2),
+                                     ray.origin, ray.direction, t, u, v) &&
                 t < tnear) {
                 tnear = t;
                 index = k;
@@ -159,20 +184,18 @@ public:
 
     Bounds3 getBounds() { return bounding_box; }
 
+    // the OBJ texture coordinates are not loaded, st is left at 0
     void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
                               const uint32_t& index, const Vector2f& uv,
                               Vector3f& N, Vector2f& st) const
     {
-        const Vector3f& v0 = vertices[vertexIndex[index * 3]];
-        const Vector3f& v1 = vertices[vertexIndex[index * 3 + 1]];
-        const Vector3f& v2 = vertices[vertexIndex[index * 3 + 2]];
+        const Vector3f& v0 = vertex(index, 0);
+        const Vector3f& v1 = vertex(index, 1);
+        const Vector3f& v2 = vertex(index, 2);
         Vector3f e0 = normalize(v1 - v0);
         Vector3f e1 = normalize(v2 - v1);
         N = normalize(crossProduct(e0, e1));
-        const Vector2f& st0 = stCoordinates[vertexIndex[index * 3]];
-        const Vector2f& st1 = stCoordinates[vertexIndex[index * 3 + 1]];
-        const Vector2f& st2 = stCoordinates[vertexIndex[index * 3 + 2]];
-        st = st0 * (1 - uv.x - uv.y) + st1 * uv.x + st2 * uv.y;
+        st = Vector2f(0);
     }
 
     Vector3f evalDiffuseColor(const Vector2f& st) const
@@ -206,13 +229,85 @@ public:
         return m->hasEmission();
     }
 
+    // PrimitiveSet, one primitive per triangle
+    int primitiveCount() const override { return (int)numTriangles; }
+    Bounds3 primitiveBounds(int k) const override
+    {
+        return Union(Bounds3(vertex(k, 0), vertex(k, 1)), vertex(k, 2));
+    }
+    float primitiveArea(int k) const override
+    {
+        return crossProduct(vertex(k, 1) - vertex(k, 0),
+                            vertex(k, 2) - vertex(k, 0)).norm() * 0.5f;
+    }
+    void intersectPrimitive(int k, const Ray& ray,
+                            Intersection& isect) const override
+    {
+        const Vector3f e1 = vertex(k, 1) - vertex(k, 0);
+        const Vector3f e2 = vertex(k, 2) - vertex(k, 0);
+        const Vector3f normal = normalize(crossProduct(e1, e2));
+        double t;
+        if (!triangleHit(vertex(k, 0), e1, e2, normal, ray, t) ||
+            t >= isect.distance)
+            return;
+        isect.happened = true;
+        isect.coords = ray(t);
+        isect.normal = normal;
+        isect.distance = t;
+        isect.obj = const_cast<MeshTriangle*>(this);
+        isect.m = m;
+    }
+    bool intersectPrimitiveP(int k, const Ray& ray) const override
+    {
+        const Vector3f e1 = vertex(k, 1) - vertex(k, 0);
+        const Vector3f e2 = vertex(k, 2) - vertex(k, 0);
+        double t;
+        return triangleHit(vertex(k, 0), e1, e2,
+                           normalize(crossProduct(e1, e2)), ray, t) &&
+               t <= ray.t_max;
+    }
+    void samplePrimitive(int k, Intersection& pos, float& pdf) const override
+    {
+        const Vector3f& v0 = vertex(k, 0);
+        const Vector3f& v1 = vertex(k, 1);
+        const Vector3f& v2 = vertex(k, 2);
+        float x = std::sqrt(get_random_float()), y = get_random_float();
+        pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+        pos.normal = normalize(crossProduct(v1 - v0, v2 - v0));
+        pdf = 1.0f / primitiveArea(k);
+    }
+
+    const Vector3f& vertex(uint32_t k, int corner) const
+    {
+        return vertices[vertexIndex[3 * k + corner]];
+    }
+
+    // bounding_box and area from the current vertices
+    void updateBounds()
+    {
+        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
+                                     std::numeric_limits<float>::infinity(),
+                                     std::numeric_limits<float>::infinity()};
+        Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
+                                     -std::numeric_limits<float>::infinity(),
+                                     -std::numeric_limits<float>::infinity()};
+        area = 0;
+        for (uint32_t k = 0; k < numTriangles; ++k) {
+            for (int j = 0; j < 3; j++) {
+                min_vert = Vector3f::Min(min_vert, vertex(k, j));
+                max_vert = Vector3f::Max(max_vert, vertex(k, j));
+            }
+            area += primitiveArea(k);
+        }
+        bounding_box = Bounds3(min_vert, max_vert);
+    }
+
     Bounds3 bounding_box;
-    std::unique_ptr<Vector3f[]> vertices;
+    // views into mesh, which owns or maps the buffers
+    IndexedMesh mesh;
+    const Vector3f* vertices;
     uint32_t numTriangles;
-    std::unique_ptr<uint32_t[]> vertexIndex;
-    std::unique_ptr<Vector2f[]> stCoordinates;
-
-    std::vector<Triangle> triangles;
+    const uint32_t* vertexIndex;
 
     BVHAccel* bvh;
     float area;
@@ -220,7 +315,11 @@ public:
     Material* m;
 };
 
-inline bool Triangle::intersect(const Ray& ray) { return true; }
+inline bool Triangle::intersect(const Ray& ray)
+{
+    double t;
+    return hit(ray, t) && t <= ray.t_max;
+}
 inline bool Triangle::intersect(const Ray& ray, float& tnear,
                                 uint32_t& index) const
 {
@@ -229,31 +328,17 @@ inline bool Triangle::intersect(const Ray& ray, float& tnear,
 
 inline Bounds3 Triangle::getBounds() { return Union(Bounds3(v0, v1), v2); }
 
+inline bool Triangle::hit(const Ray& ray, double& t) const
+{
+    return triangleHit(v0, e1, e2, normal, ray, t);
+}
+
 inline Intersection Triangle::getIntersection(Ray ray)
 {
     Intersection inter;
 
-    if (dotProduct(ray.direction, normal) > 0)
-        return inter;
-    double u, v, t_tmp = 0;
-    Vector3f pvec = crossProduct(ray.direction, e2);
-    double det = dotProduct(e1, pvec);
-    if (fabs(det) < EPSILON)
-        return inter;
-
-    double det_inv = 1. / det;
-    Vector3f tvec = ray.origin - v0;
-    u = dotProduct(tvec, pvec) * det_inv;
-    if (u < 0 || u > 1)
-        return inter;
-    Vector3f qvec = crossProduct(tvec, e1);
-    v = dotProduct(ray.direction, qvec) * det_inv;
-    if (v < 0 || u + v > 1)
-        return inter;
-    t_tmp = dotProduct(e2, qvec) * det_inv;
-
-    // TODO find ray triangle intersection
-    if (t_tmp < 0)
+    double t_tmp;
+    if (!hit(ray, t_tmp))
         return inter;
     inter.happened = true;
     inter.coords = ray(t_tmp);
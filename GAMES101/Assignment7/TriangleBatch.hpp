@@ -0,0 +1,131 @@
+//
+// SoA packs of triangles that are intersected with one ray in a single pass.
+//
+
+#ifndef RAYTRACING_TRIANGLEBATCH_H
+#define RAYTRACING_TRIANGLEBATCH_H
+
+#include <algorithm>
+#include <limits>
+#include "Ray.hpp"
+#include "Simd.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+
+// Up to width triangles stored as v0 and the two edges, one array per
+// component. Unused lanes keep zero edges and never report a hit.
+struct alignas(32) TriangleBatch
+{
+    static constexpr int width = SIMD_WIDTH;
+
+    float v0[3][width] = {};
+    float e1[3][width] = {};
+    float e2[3][width] = {};
+
+    void set(int lane, const Vector3f& p0, const Vector3f& edge1,
+             const Vector3f& edge2)
+    {
+        for (int k = 0; k < 3; ++k) {
+            v0[k][lane] = p0[k];
+            e1[k][lane] = edge1[k];
+            e2[k][lane] = edge2[k];
+        }
+    }
+
+    // closest lane hit in front of the ray before tMax, -1 if there is none
+    int intersect(const Ray& ray, double tMax, float& tHit) const
+    {
+        alignas(32) float t[width];
+        int mask = hitMask(ray, tMax, t);
+        int lane = -1;
+        for (int i = 0; i < width; ++i) {
+            if ((mask >> i & 1) && (lane < 0 || t[i] < t[lane]))
+                lane = i;
+        }
+        if (lane >= 0)
+            tHit = t[lane];
+        return lane;
+    }
+
+    bool intersectP(const Ray& ray, double tMax) const
+    {
+        alignas(32) float t[width];
+        return hitMask(ray, tMax, t) != 0;
+    }
+
+private:
+    // Moller-Trumbore against the front faces of all lanes, the same test as
+    // Triangle::hit. Bit i is set when lane i is hit at t[i] < tMax; t takes
+    // an aligned store, like the loads of the batch.
+    int hitMask(const Ray& ray, double tMax, float* t) const;
+};
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+inline int TriangleBatch::hitMask(const Ray& ray, double tMax, float* t) const
+{
+    using namespace simd;
+    const vfloat dx = set1(ray.direction.x), dy = set1(ray.direction.y),
+                 dz = set1(ray.direction.z);
+    const vfloat e1x = load(e1[0]), e1y = load(e1[1]), e1z = load(e1[2]);
+    const vfloat e2x = load(e2[0]), e2y = load(e2[1]), e2z = load(e2[2]);
+
+    vfloat px = sub(mul(dy, e2z), mul(dz, e2y));
+    vfloat py = sub(mul(dz, e2x), mul(dx, e2z));
+    vfloat pz = sub(mul(dx, e2y), mul(dy, e2x));
+    vfloat det = add(add(mul(e1x, px), mul(e1y, py)), mul(e1z, pz));
+    vfloat detInv = div(set1(1.f), det);
+
+    vfloat tx = sub(set1(ray.origin.x), load(v0[0]));
+    vfloat ty = sub(set1(ray.origin.y), load(v0[1]));
+    vfloat tz = sub(set1(ray.origin.z), load(v0[2]));
+    vfloat u = mul(add(add(mul(tx, px), mul(ty, py)), mul(tz, pz)), detInv);
+
+    vfloat qx = sub(mul(ty, e1z), mul(tz, e1y));
+    vfloat qy = sub(mul(tz, e1x), mul(tx, e1z));
+    vfloat qz = sub(mul(tx, e1y), mul(ty, e1x));
+    vfloat v = mul(add(add(mul(dx, qx), mul(dy, qy)), mul(dz, qz)), detInv);
+    vfloat tt = mul(add(add(mul(e2x, qx), mul(e2y, qy)), mul(e2z, qz)), detInv);
+
+    const vfloat zero = set1(0.f), one = set1(1.f);
+    const float tMaxf =
+        (float)std::min(tMax, (double)std::numeric_limits<float>::max());
+    // det > 0 is the front face, back faces and slivers fail the first test
+    vfloat hit = ge(det, set1(EPSILON));
+    hit = mask_and(hit, mask_and(ge(u, zero), le(u, one)));
+    hit = mask_and(hit, mask_and(ge(v, zero), le(add(u, v), one)));
+    hit = mask_and(hit, mask_and(ge(tt, zero), lt(tt, set1(tMaxf))));
+    store(t, tt);
+    return movemask(hit);
+}
+#else
+inline int TriangleBatch::hitMask(const Ray& ray, double tMax, float* t) const
+{
+    const Vector3f& d = ray.direction;
+    const float tMaxf =
+        (float)std::min(tMax, (double)std::numeric_limits<float>::max());
+    int mask = 0;
+    for (int i = 0; i < width; ++i) {
+        Vector3f edge1(e1[0][i], e1[1][i], e1[2][i]);
+        Vector3f edge2(e2[0][i], e2[1][i], e2[2][i]);
+        Vector3f pvec = crossProduct(d, edge2);
+        float det = dotProduct(edge1, pvec);
+        if (!(det >= EPSILON))
+            continue;
+        float detInv = 1.f / det;
+        Vector3f tvec = ray.origin - Vector3f(v0[0][i], v0[1][i], v0[2][i]);
+        float u = dotProduct(tvec, pvec) * detInv;
+        if (u < 0 || u > 1)
+            continue;
+        Vector3f qvec = crossProduct(tvec, edge1);
+        float v = dotProduct(d, qvec) * detInv;
+        if (v < 0 || u + v > 1)
+            continue;
+        t[i] = dotProduct(edge2, qvec) * detInv;
+        if (t[i] >= 0 && t[i] < tMaxf)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+#endif
+
+#endif // RAYTRACING_TRIANGLEBATCH_H
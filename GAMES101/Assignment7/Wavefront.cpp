@@ -0,0 +1,182 @@
+//
+// Wavefront variant of the path tracer in Scene::castRay. Instead of following
+// one path to its end, all paths of a tile take one bounce per round:
+//
+//   generate: one camera ray per pixel sample
+//   extend:   closest hit of every queued ray
+//   shade:    emission, light sample and the next BSDF ray of every hit
+//   shadow:   visibility of the light samples
+//
+// The shading is the same as castRay and draws the same random numbers in the
+// same order, so both modes render the same image up to float rounding.
+//
+
+#include <chrono>
+#include "Renderer.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+void Renderer::RenderTileWavefront(const Scene& scene, const Tile& tile,
+                                   int firstSample, int nSamples,
+                                   std::vector<Vector3f>& tileBuffer,
+                                   WavefrontStats& stats) const
+{
+    // the queues are reused from tile to tile, only the first one allocates
+    thread_local PathStates paths;
+    thread_local RayQueue rays, nextRays;
+    thread_local HitQueue hits;
+    thread_local ShadowQueue shadows;
+
+    const int w = tile.x1 - tile.x0;
+    const int nPaths = w * (tile.y1 - tile.y0) * nSamples;
+    paths.resize(nPaths);
+    rays.clear();
+
+    // generate
+    auto start = Clock::now();
+    for (int p = 0; p < nPaths; ++p) {
+        int local = p / nSamples, k = firstSample + p % nSamples;
+        int i = tile.x0 + local % w, j = tile.y0 + local / w;
+        paths.depth[p] = 0;
+        paths.L.set(p, Vector3f(0));
+        paths.beta.set(p, Vector3f(1));
+        paths.bsdfPdf[p] = 0;
+        paths.sampler[p].type = samplerType;
+        paths.sampler[p].startPixelSample(seed, j * scene.width + i, k);
+        rays.push(eye_pos, PrimaryDirection(scene, i, j), p);
+    }
+    stats.seconds[Generate] += secondsSince(start);
+    stats.rays[Generate] += nPaths;
+
+    Sampler& sampler = get_sampler();
+    while (rays.size() > 0) {
+        // extend
+        start = Clock::now();
+        hits.clear();
+        for (int r = 0; r < rays.size(); ++r) {
+            Intersection inter = scene.intersect(
+                rays.ray(r),
+                paths.depth[rays.path[r]] == 0 ? CameraRay : IndirectRay);
+            if (!inter.happened)
+                continue;
+            hits.coords.push(inter.coords);
+            hits.normal.push(inter.normal);
+            hits.wo.push(rays.direction[r]);
+            hits.distance.push_back(inter.distance);
+            hits.m.push_back(inter.m);
+            hits.path.push_back(rays.path[r]);
+        }
+        stats.seconds[Extend] += secondsSince(start);
+        stats.rays[Extend] += rays.size();
+
+        // shade
+        start = Clock::now();
+        shadows.clear();
+        nextRays.clear();
+        for (int h = 0; h < hits.size(); ++h) {
+            const int p = hits.path[h];
+            Material* m = hits.m[h];
+            const Vector3f beta = paths.beta[p];
+            const Vector3f wo = hits.wo[h];
+
+            if (m->hasEmission()) {
+                // camera rays see the light directly, BSDF rays are weighted
+                // against the light sample that could have found this point
+                Vector3f Le = m->getEmission();
+                if (paths.depth[p] == 0) {
+                    paths.L.set(p, paths.L[p] + Le);
+                }
+                else {
+                    float cos_light = dotProduct(hits.normal[h], -wo);
+                    if (cos_light > 0) {
+                        float d = hits.distance[h];
+                        float pdf_light =
+                            scene.lightPdf(Le) * d * d / cos_light;
+                        float weight =
+                            powerHeuristic(paths.bsdfPdf[p], pdf_light);
+                        paths.L.set(p, paths.L[p] + beta * Le * weight);
+                    }
+                }
+                continue;
+            }
+
+            sampler = paths.sampler[p];
+            Vector3f P = hits.coords[h];
+            Vector3f N = hits.normal[h].normalized();
+
+            float pdf_L = 1.0;
+            Intersection light_inter;
+            scene.sampleLight(light_inter, pdf_L);
+            Vector3f x = light_inter.coords;
+            Vector3f ws = (x - P).normalized();
+            Vector3f NN = light_inter.normal.normalized();
+            float d = (x - P).norm();
+            float cos_theta = dotProduct(N, ws);
+            float cos_theta_x = dotProduct(NN, -ws);
+            if (pdf_L > 0 && cos_theta > 0 && cos_theta_x > 0) {
+                float pdf_light = pdf_L * d * d / cos_theta_x;
+                float weight = powerHeuristic(pdf_light, m->pdf(wo, ws, N));
+                shadows.rays.push(P, ws, p);
+                shadows.tMax.push_back(d - 0.001);
+                shadows.contribution.push(beta * light_inter.emit *
+                                          m->eval(wo, ws, N) * cos_theta /
+                                          pdf_light * weight);
+            }
+
+            if (get_random_float() < scene.RussianRoulette) {
+                Vector3f wi = m->sample(wo, N).normalized();
+                float pdf_O = m->pdf(wo, wi, N);
+                if (pdf_O > 0) {
+                    float cos_wi = dotProduct(wi, N);
+                    paths.beta.set(p, beta * m->eval(wo, wi, N) * cos_wi /
+                                          pdf_O / scene.RussianRoulette);
+                    paths.bsdfPdf[p] = pdf_O;
+                    ++paths.depth[p];
+                    nextRays.push(P, wi, p);
+                }
+            }
+            paths.sampler[p] = sampler;
+        }
+        stats.seconds[Shade] += secondsSince(start);
+        stats.rays[Shade] += hits.size();
+
+        // shadow
+        start = Clock::now();
+        for (int s = 0; s < shadows.size(); ++s) {
+            Ray ray = shadows.rays.ray(s);
+            ray.t_max = shadows.tMax[s];
+            if (!scene.intersectP(ray)) {
+                int p = shadows.rays.path[s];
+                paths.L.set(p, paths.L[p] + shadows.contribution[s]);
+            }
+        }
+        stats.seconds[Shadow] += secondsSince(start);
+        stats.rays[Shadow] += shadows.size();
+
+        std::swap(rays, nextRays);
+    }
+
+    // a path is made of its camera ray and one ray per bounce
+    if (statsEnabled) {
+        RayStats& counters = rayStats();
+        for (int p = 0; p < nPaths; ++p)
+            counters.addPath(paths.depth[p] + 1);
+    }
+
+    // samples are added in order, like the recursive loop does
+    for (int local = 0; local < nPaths / nSamples; ++local) {
+        Vector3f color;
+        for (int k = 0; k < nSamples; ++k)
+            color += paths.L[local * nSamples + k] / nSamples;
+        tileBuffer[local] = color;
+    }
+}
@@ -0,0 +1,116 @@
+//
+// Buffers of the wavefront path tracer. All paths of a tile advance together
+// one bounce at a time, every stage runs over a whole queue before the next
+// one starts, and everything is kept as one array per component.
+//
+
+#ifndef RAYTRACING_WAVEFRONT_H
+#define RAYTRACING_WAVEFRONT_H
+
+#include <cstdint>
+#include <vector>
+#include "Ray.hpp"
+#include "Sampler.hpp"
+#include "Vector.hpp"
+
+class Material;
+
+struct Vec3Array
+{
+    std::vector<float> x, y, z;
+
+    void clear() { x.clear(); y.clear(); z.clear(); }
+    void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+    void push(const Vector3f& v)
+    {
+        x.push_back(v.x);
+        y.push_back(v.y);
+        z.push_back(v.z);
+    }
+    void set(int i, const Vector3f& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+    Vector3f operator[](int i) const { return Vector3f(x[i], y[i], z[i]); }
+};
+
+// Per path state, indexed by pixel * samples + sample. Every path keeps its own
+// sampler so it draws the same numbers as the recursive castRay would.
+struct PathStates
+{
+    std::vector<int> depth;
+    Vec3Array L;        // radiance gathered so far
+    Vec3Array beta;     // throughput from the camera to the current vertex
+    std::vector<float> bsdfPdf;  // pdf of the BSDF sample that led here
+    std::vector<Sampler> sampler;
+
+    void resize(size_t n)
+    {
+        depth.resize(n);
+        L.resize(n);
+        beta.resize(n);
+        bsdfPdf.resize(n);
+        sampler.resize(n);
+    }
+};
+
+// rays waiting for the extend stage
+struct RayQueue
+{
+    Vec3Array origin, direction;
+    std::vector<int> path;
+
+    int size() const { return (int)path.size(); }
+    void clear() { origin.clear(); direction.clear(); path.clear(); }
+    void push(const Vector3f& o, const Vector3f& d, int p)
+    {
+        origin.push(o);
+        direction.push(d);
+        path.push_back(p);
+    }
+    Ray ray(int i) const { return Ray(origin[i], direction[i]); }
+};
+
+// closest hits waiting for the shade stage
+struct HitQueue
+{
+    Vec3Array coords, normal, wo;
+    std::vector<float> distance;
+    std::vector<Material*> m;
+    std::vector<int> path;
+
+    int size() const { return (int)path.size(); }
+    void clear()
+    {
+        coords.clear(); normal.clear(); wo.clear();
+        distance.clear(); m.clear(); path.clear();
+    }
+};
+
+// light samples waiting for the visibility test, contribution is added to
+// the path when nothing blocks the ray before tMax
+struct ShadowQueue
+{
+    RayQueue rays;
+    std::vector<float> tMax;
+    Vec3Array contribution;
+
+    int size() const { return rays.size(); }
+    void clear() { rays.clear(); tMax.clear(); contribution.clear(); }
+};
+
+enum WavefrontStage { Generate, Extend, Shade, Shadow, NumStages };
+
+// rays processed and time spent per stage, summed over all tiles and threads
+struct WavefrontStats
+{
+    int64_t rays[NumStages] = {};
+    double seconds[NumStages] = {};
+
+    void add(const WavefrontStats& other)
+    {
+        for (int s = 0; s < NumStages; ++s) {
+            rays[s] += other.rays[s];
+            seconds[s] += other.seconds[s];
+        }
+    }
+};
+
+#endif // RAYTRACING_WAVEFRONT_H
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include "Sampler.hpp"
 
 #undef M_PI
 #define M_PI 3.141592653589793f
@@ -28,13 +29,16 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
     return true;
 }
 
-inline float get_random_float()
+// Power heuristic (beta = 2) of Veach's multiple importance sampling
+inline float powerHeuristic(float pdfA, float pdfB)
 {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
+    return pdfA * pdfA / (pdfA * pdfA + pdfB * pdfB);
+}
 
-    return dist(rng);
+// Draws the next number of the current sample from the thread's sampler
+inline float get_random_float()
+{
+    return get_sampler().get1D();
 }
 
 inline void UpdateProgress(float progress)
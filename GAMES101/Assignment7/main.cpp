@@ -5,6 +5,8 @@
 #include "Vector.hpp"
 #include "global.hpp"
 #include <chrono>
+#include <cstdlib>
+#include <string>
 
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
@@ -42,6 +44,17 @@ int main(int argc, char** argv)
     scene.buildBVH();
 
     Renderer r;
+    // optional: number of render threads, all cores are used by default
+    if (argc > 1)
+        r.numThreads = std::atoi(argv[1]);
+    // optional: "wavefront" traces the paths in batches instead of recursively
+    if (argc > 2 && std::string(argv[2]) == "wavefront")
+        r.mode = RenderMode::Wavefront;
+    // optional: checkpoint file, renders progressively and resumes from it
+    if (argc > 3) {
+        r.progressive = true;
+        r.checkpointPath = argv[3];
+    }
 
     auto start = std::chrono::system_clock::now();
     r.Render(scene);
@@ -22,35 +22,43 @@ void Application::init() {
   glLineWidth(4);
 
   glColor3f(1.0, 1.0, 1.0);
-  // Create two ropes 
-  ropeEuler = new Rope(Vector2D(0, 200), Vector2D(-400, 200), 3, config.mass,
-                       config.ks, {0});
-  ropeVerlet = new Rope(Vector2D(0, 200), Vector2D(-400, 200), 3, config.mass,
-                        config.ks, {0});
+  // Create two ropes, and more side by side on request. The ropes of an
+  // integrator share one Rope, so its solver loops run over all of them.
+  Rope *euler = new Rope();
+  Rope *verlet = new Rope();
+  for (int i = 0; i < config.num_ropes; i++) {
+    Vector2D offset(config.num_ropes > 1 ? 800.0 * i / (config.num_ropes - 1) - 400 : 0, 0);
+    euler->add_rope(Vector2D(0, 200) + offset, Vector2D(-400, 200) + offset, 3,
+                    config.mass, config.ks, {0});
+    verlet->add_rope(Vector2D(0, 200) + offset, Vector2D(-400, 200) + offset, 3,
+                     config.mass, config.ks, {0});
+  }
+  simulation.add(euler, Integrator::Euler);
+  simulation.add(verlet, Integrator::Verlet);
+  if (config.cloth_size > 1) {
+    Rope *cloth = new Rope();
+    int n = config.cloth_size;
+    cloth->add_cloth(Vector2D(-200, 250), Vector2D(200, -150), n, n, config.mass,
+                     config.ks, {0, n - 1});
+    simulation.add(cloth, Integrator::Verlet);
+  }
+  simulation.start(config.gravity, config.steps_per_frame);
 }
 
 void Application::render() {
-  //Simulation loops
-  for (int i = 0; i < config.steps_per_frame; i++) {
-    ropeEuler->simulateEuler(1 / config.steps_per_frame, config.gravity);
-    ropeVerlet->simulateVerlet(1 / config.steps_per_frame, config.gravity);
-  }
-  // Rendering ropes
-  Rope *rope;
-
-  for (int i = 0; i < 2; i++) {
-    if (i == 0) {
+  // the simulation runs on its own thread, draw its last finished frame
+  for (int i = 0; i < simulation.num_ropes(); i++) {
+    const Rope &rope = simulation.rope(i);
+    simulation.latest_positions(i, positions);
+    if (simulation.integrator(i) == Integrator::Euler) {
       glColor3f(0.0, 0.0, 1.0);
-      rope = ropeEuler;
     } else {
       glColor3f(0.0, 1.0, 0.0);
-      rope = ropeVerlet;
     }
 
     glBegin(GL_POINTS);
 
-    for (auto &m : rope->masses) {
-      Vector2D p = m->position;
+    for (auto &p : positions) {
       glVertex2d(p.x, p.y);
     }
 
@@ -58,9 +66,9 @@ void Application::render() {
 
     glBegin(GL_LINES);
 
-    for (auto &s : rope->springs) {
-      Vector2D p1 = s->m1->position;
-      Vector2D p2 = s->m2->position;
+    for (size_t s = 0; s < rope.num_springs(); s++) {
+      Vector2D p1 = positions[rope.spring_m1[s]];
+      Vector2D p2 = positions[rope.spring_m2[s]];
       glVertex2d(p1.x, p1.y);
       glVertex2d(p2.x, p2.y);
     }
@@ -94,13 +102,15 @@ void Application::keyboard_event(int key, int event, unsigned char mods) {
     config.steps_per_frame *= 2;
     break;
   }
+  simulation.set_steps_per_frame(config.steps_per_frame);
 }
 
 string Application::name() { return "Rope Simulator"; }
 
 string Application::info() {
   ostringstream steps;
-  steps << "Steps per frame: " << config.steps_per_frame;
+  steps << "Steps per frame: " << config.steps_per_frame
+        << ", simulated frames/s: " << (int)simulation.measured_frame_rate();
 
   return steps.str();
 }
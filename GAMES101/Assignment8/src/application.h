@@ -14,6 +14,7 @@
 #include "CGL/renderer.h"
 
 #include "rope.h"
+#include "simulation.h"
 
 using namespace std;
 
@@ -24,6 +25,8 @@ struct AppConfig {
     // Rope config variables
     mass = 1;
     ks = 100;
+    num_ropes = 1;
+    cloth_size = 0;
 
     // Environment variables
     gravity = Vector2D(0, -1);
@@ -32,6 +35,9 @@ struct AppConfig {
 
   float mass;
   float ks;
+  // ropes per integrator, and masses per side of a Verlet cloth (0: none)
+  int num_ropes;
+  int cloth_size;
 
   float steps_per_frame;
   Vector2D gravity;
@@ -57,8 +63,9 @@ public:
 private:
   AppConfig config;
 
-  Rope *ropeEuler;
-  Rope *ropeVerlet;
+  Simulation simulation;
+  // positions copied from the simulation for drawing
+  vector<Vector2D> positions;
 
   size_t screen_width;
   size_t screen_height;
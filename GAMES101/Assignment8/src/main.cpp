@@ -16,6 +16,8 @@ void usage(const char *binaryName) {
   printf("  -m  <FLOAT>            Mass per node\n");
   printf("  -g  <FLOAT> <FLOAT>    Gravity vector (x, y)\n");
   printf("  -s  <INT>              Number of steps per simulation frame\n");
+  printf("  -r  <INT>              Number of ropes per integrator\n");
+  printf("  -c  <INT>              Also simulate a cloth of INT x INT masses\n");
   printf("\n");
 }
 
@@ -35,6 +37,12 @@ int main(int argc, char **argv) {
     case 's':
       config.steps_per_frame = atoi(optarg);
       break;
+    case 'r':
+      config.num_ropes = atoi(optarg);
+      break;
+    case 'c':
+      config.cloth_size = atoi(optarg);
+      break;
     default:
       usage(argv[0]);
       return 1;
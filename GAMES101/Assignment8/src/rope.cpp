@@ -1,61 +1,211 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <vector>
 
 #include "CGL/vector2D.h"
 
-#include "mass.h"
 #include "rope.h"
-#include "spring.h"
 
 namespace CGL {
 
+    // Loops shorter than this stay on the calling thread, starting the
+    // OpenMP team costs more than they do.
+    static const int parallel_threshold = 4096;
+
+    // Global damping of the two integrators
+    static const float euler_damping = 0.01f;
+    static const float verlet_damping = 0.00005f;
+
     Rope::Rope(Vector2D start, Vector2D end, int num_nodes, float node_mass, float k, vector<int> pinned_nodes)
     {
-        // TODO (Part 1): Create a rope starting at `start`, ending at `end`, and containing `num_nodes` nodes.
+        add_rope(start, end, num_nodes, node_mass, k, pinned_nodes);
+    }
 
-//        Comment-in this part when you implement the constructor
-//        for (auto &i : pinned_nodes) {
-//            masses[i]->pinned = true;
-//        }
+    int Rope::add_rope(Vector2D start, Vector2D end, int num_nodes, float node_mass, float k,
+                       const vector<int> &pinned_nodes)
+    {
+        int first = (int)num_masses();
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            float t = num_nodes > 1 ? (float)i / (num_nodes - 1) : 0;
+            add_mass(start + (end - start) * t, node_mass);
+            if (i > 0)
+                add_spring(first + i - 1, first + i, k);
+        }
+        for (auto &i : pinned_nodes)
+            pinned[first + i] = true;
+        color_springs();
+        return first;
     }
 
-    void Rope::simulateEuler(float delta_t, Vector2D gravity)
+    int Rope::add_cloth(Vector2D top_left, Vector2D bottom_right, int columns, int rows, float node_mass,
+                        float k, const vector<int> &pinned_nodes)
+    {
+        int first = (int)num_masses();
+        auto node = [&](int column, int row) { return first + row * columns + column; };
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                float u = columns > 1 ? (float)column / (columns - 1) : 0;
+                float v = rows > 1 ? (float)row / (rows - 1) : 0;
+                add_mass(Vector2D(top_left.x + (bottom_right.x - top_left.x) * u,
+                                  top_left.y + (bottom_right.y - top_left.y) * v),
+                         node_mass);
+            }
+        }
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                if (column + 1 < columns)
+                    add_spring(node(column, row), node(column + 1, row), k);
+                if (row + 1 < rows)
+                    add_spring(node(column, row), node(column, row + 1), k);
+                if (column + 1 < columns && row + 1 < rows)
+                {
+                    add_spring(node(column, row), node(column + 1, row + 1), k);
+                    add_spring(node(column + 1, row), node(column, row + 1), k);
+                }
+            }
+        }
+        for (auto &i : pinned_nodes)
+            pinned[first + i] = true;
+        color_springs();
+        return first;
+    }
+
+    int Rope::add_mass(Vector2D p, float m)
+    {
+        start_position.push_back(p);
+        position.push_back(p);
+        last_position.push_back(p);
+        velocity.push_back(Vector2D(0, 0));
+        forces.push_back(Vector2D(0, 0));
+        mass.push_back(m);
+        pinned.push_back(false);
+        return (int)num_masses() - 1;
+    }
+
+    void Rope::add_spring(int m1, int m2, float k)
     {
-        for (auto &s : springs)
+        spring_m1.push_back(m1);
+        spring_m2.push_back(m2);
+        spring_k.push_back(k);
+        rest_length.push_back((position[m1] - position[m2]).norm());
+    }
+
+    // Greedy coloring: every spring takes the lowest color that no other
+    // spring at either of its masses has yet. A rope needs two colors, the
+    // cloth grid a handful.
+    void Rope::color_springs()
+    {
+        const int max_colors = 64;
+        vector<uint64_t> used(num_masses(), 0);
+        vector<int> color(num_springs());
+        int num_colors = 0;
+        for (size_t s = 0; s < num_springs(); ++s)
+        {
+            uint64_t taken = used[spring_m1[s]] | used[spring_m2[s]];
+            int c = 0;
+            while (c < max_colors && (taken >> c & 1))
+                ++c;
+            assert(c < max_colors && "a mass has too many springs to color");
+            color[s] = c;
+            used[spring_m1[s]] |= uint64_t(1) << c;
+            used[spring_m2[s]] |= uint64_t(1) << c;
+            num_colors = std::max(num_colors, c + 1);
+        }
+
+        // counting sort of the springs by color, stable within a color
+        color_start.assign(num_colors + 1, 0);
+        for (int c : color)
+            ++color_start[c + 1];
+        for (int c = 0; c < num_colors; ++c)
+            color_start[c + 1] += color_start[c];
+        vector<int> next(color_start.begin(), color_start.end() - 1);
+        vector<int> m1(num_springs()), m2(num_springs());
+        vector<float> k(num_springs());
+        vector<double> rest(num_springs());
+        for (size_t s = 0; s < num_springs(); ++s)
         {
-            // TODO (Part 2): Use Hooke's law to calculate the force on a node
+            int to = next[color[s]]++;
+            m1[to] = spring_m1[s];
+            m2[to] = spring_m2[s];
+            k[to] = spring_k[s];
+            rest[to] = rest_length[s];
         }
+        spring_m1.swap(m1);
+        spring_m2.swap(m2);
+        spring_k.swap(k);
+        rest_length.swap(rest);
+    }
 
-        for (auto &m : masses)
+    // Hooke's law, one color at a time. The springs of a color touch
+    // disjoint masses, so their force updates run in parallel.
+    void Rope::apply_spring_forces()
+    {
+        for (size_t c = 0; c + 1 < color_start.size(); ++c)
         {
-            if (!m->pinned)
+            const int begin = color_start[c], end = color_start[c + 1];
+#pragma omp parallel for if (end - begin >= parallel_threshold)
+            for (int s = begin; s < end; ++s)
             {
-                // TODO (Part 2): Add the force due to gravity, then compute the new velocity and position
+                int a = spring_m1[s], b = spring_m2[s];
+                Vector2D d = position[b] - position[a];
+                double length = d.norm();
+                if (length == 0)
+                    continue;
+                Vector2D f = d * (spring_k[s] * (length - rest_length[s]) / length);
+                forces[a] += f;
+                forces[b] -= f;
+            }
+        }
+    }
+
+    void Rope::simulateEuler(float delta_t, Vector2D gravity)
+    {
+        apply_spring_forces();
 
-                // TODO (Part 2): Add global damping
+        const int n = (int)num_masses();
+#pragma omp parallel for if (n >= parallel_threshold)
+        for (int i = 0; i < n; ++i)
+        {
+            if (!pinned[i])
+            {
+                // gravity and global damping, then semi-implicit Euler: the
+                // new velocity moves the mass, which keeps the rope stable
+                Vector2D f = forces[i] + gravity * mass[i] - velocity[i] * euler_damping;
+                velocity[i] += f / mass[i] * delta_t;
+                position[i] += velocity[i] * delta_t;
             }
 
             // Reset all forces on each mass
-            m->forces = Vector2D(0, 0);
+            forces[i] = Vector2D(0, 0);
         }
     }
 
     void Rope::simulateVerlet(float delta_t, Vector2D gravity)
     {
-        for (auto &s : springs)
-        {
-            // TODO (Part 3): Simulate one timestep of the rope using explicit Verlet （solving constraints)
-        }
+        apply_spring_forces();
 
-        for (auto &m : masses)
+        const int n = (int)num_masses();
+#pragma omp parallel for if (n >= parallel_threshold)
+        for (int i = 0; i < n; ++i)
         {
-            if (!m->pinned)
+            if (!pinned[i])
             {
-                Vector2D temp_position = m->position;
-                // TODO (Part 3.1): Set the new position of the rope mass
-                
-                // TODO (Part 4): Add global Verlet damping
+                Vector2D temp_position = position[i];
+                Vector2D a = forces[i] / mass[i] + gravity;
+                // global Verlet damping takes a little of the last step away
+                position[i] += (position[i] - last_position[i]) * (1 - verlet_damping) +
+                               a * delta_t * delta_t;
+                last_position[i] = temp_position;
             }
+
+            forces[i] = Vector2D(0, 0);
         }
     }
 }
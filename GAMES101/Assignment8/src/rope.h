@@ -1,26 +1,65 @@
 #ifndef ROPE_H
 #define ROPE_H
 
+#include <vector>
+
 #include "CGL/CGL.h"
-#include "mass.h"
-#include "spring.h"
+#include "CGL/vector2D.h"
 
 using namespace std;
 
 namespace CGL {
 
+// Masses and springs of any number of ropes and cloths, one array per
+// attribute, so that the solver loops walk memory in order. Springs are
+// sorted by color: no two springs of a color share a mass, so the springs
+// of one color can be updated in parallel without locks.
 class Rope {
 public:
-  Rope(vector<Mass *> &masses, vector<Spring *> &springs)
-      : masses(masses), springs(springs) {}
+  Rope() {}
   Rope(Vector2D start, Vector2D end, int num_nodes, float node_mass, float k,
        vector<int> pinned_nodes);
 
+  // Adds a rope of num_nodes masses from start to end, springs between
+  // neighbours. pinned_nodes count from the first mass of this rope.
+  // Returns the index of that mass.
+  int add_rope(Vector2D start, Vector2D end, int num_nodes, float node_mass,
+               float k, const vector<int> &pinned_nodes);
+  // Adds a columns x rows grid of masses spanning top_left to
+  // bottom_right, with structural springs between grid neighbours and shear
+  // springs across the cells. pinned_nodes are row-major from the top left.
+  // Returns the index of the first mass.
+  int add_cloth(Vector2D top_left, Vector2D bottom_right, int columns,
+                int rows, float node_mass, float k,
+                const vector<int> &pinned_nodes);
+
   void simulateVerlet(float delta_t, Vector2D gravity);
   void simulateEuler(float delta_t, Vector2D gravity);
 
-  vector<Mass *> masses;
-  vector<Spring *> springs;
+  size_t num_masses() const { return position.size(); }
+  size_t num_springs() const { return spring_m1.size(); }
+
+  // masses
+  vector<Vector2D> start_position;
+  vector<Vector2D> position;
+  vector<Vector2D> last_position; // explicit Verlet integration
+  vector<Vector2D> velocity;      // explicit Euler integration
+  vector<Vector2D> forces;
+  vector<float> mass;
+  vector<char> pinned;
+
+  // springs, the ones of color c are [color_start[c], color_start[c + 1])
+  vector<int> spring_m1;
+  vector<int> spring_m2;
+  vector<float> spring_k;
+  vector<double> rest_length;
+  vector<int> color_start;
+
+private:
+  int add_mass(Vector2D position, float mass);
+  void add_spring(int m1, int m2, float k);
+  void color_springs();
+  void apply_spring_forces();
 }; // struct Rope
 }
 #endif /* ROPE_H */
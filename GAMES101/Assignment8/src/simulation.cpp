@@ -0,0 +1,81 @@
+#include <chrono>
+
+#include "simulation.h"
+
+namespace CGL {
+
+Simulation::~Simulation() {
+  stop();
+  for (auto &entry : ropes)
+    delete entry.rope;
+}
+
+void Simulation::add(Rope *rope, Integrator integrator) {
+  Entry entry;
+  entry.rope = rope;
+  entry.integrator = integrator;
+  entry.published = rope->position;
+  ropes.push_back(entry);
+}
+
+void Simulation::start(Vector2D gravity, float steps) {
+  stop();
+  steps_per_frame = steps;
+  running = true;
+  worker = thread(&Simulation::run, this, gravity);
+}
+
+void Simulation::stop() {
+  running = false;
+  if (worker.joinable())
+    worker.join();
+}
+
+void Simulation::latest_positions(int i, vector<Vector2D> &positions) {
+  lock_guard<mutex> lock(published_lock);
+  positions = ropes[i].published;
+}
+
+void Simulation::run(Vector2D gravity) {
+  typedef chrono::steady_clock clock;
+  const auto frame_time = chrono::duration_cast<clock::duration>(
+      chrono::duration<double>(1 / frame_rate));
+  auto next_frame = clock::now();
+  auto second_start = next_frame;
+  int frames = 0;
+
+  while (running) {
+    float steps = steps_per_frame;
+    for (int i = 0; i < steps; i++) {
+      for (auto &entry : ropes) {
+        if (entry.integrator == Integrator::Euler)
+          entry.rope->simulateEuler(1 / steps, gravity);
+        else
+          entry.rope->simulateVerlet(1 / steps, gravity);
+      }
+    }
+    {
+      lock_guard<mutex> lock(published_lock);
+      for (auto &entry : ropes)
+        entry.published = entry.rope->position;
+    }
+
+    ++frames;
+    auto now = clock::now();
+    if (now - second_start >= chrono::seconds(1)) {
+      frame_rate_measured =
+          frames / chrono::duration<double>(now - second_start).count();
+      frames = 0;
+      second_start = now;
+    }
+
+    // A frame that took too long is not made up for: the simulation slows
+    // down instead of falling further behind with every frame.
+    next_frame += frame_time;
+    if (next_frame < now)
+      next_frame = now;
+    this_thread::sleep_until(next_frame);
+  }
+}
+
+} // namespace CGL
@@ -0,0 +1,63 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rope.h"
+
+using namespace std;
+
+namespace CGL {
+
+enum class Integrator { Euler, Verlet };
+
+// Steps ropes on a thread of its own, so that the render thread only draws.
+// The simulation advances in fixed frames of steps_per_frame substeps of
+// 1 / steps_per_frame each, frame_rate frames per second of wall clock time
+// whatever the render rate is. After every frame the positions are copied
+// out for the renderer.
+class Simulation {
+public:
+  explicit Simulation(double frame_rate = 60) : frame_rate(frame_rate) {}
+  ~Simulation();
+
+  // Ropes are added before start(), the simulation owns them. While it
+  // runs only their springs may be read, the masses are being moved.
+  void add(Rope *rope, Integrator integrator);
+  const Rope &rope(int i) const { return *ropes[i].rope; }
+  Integrator integrator(int i) const { return ropes[i].integrator; }
+  int num_ropes() const { return (int)ropes.size(); }
+
+  void start(Vector2D gravity, float steps_per_frame);
+  void stop();
+  void set_steps_per_frame(float steps) { steps_per_frame = steps; }
+
+  // positions of the masses of rope i at the end of the last frame
+  void latest_positions(int i, vector<Vector2D> &positions);
+  // frames simulated per second of wall clock time, over the last second
+  double measured_frame_rate() const { return frame_rate_measured; }
+
+private:
+  struct Entry {
+    Rope *rope;
+    Integrator integrator;
+    vector<Vector2D> published;
+  };
+
+  void run(Vector2D gravity);
+
+  double frame_rate;
+  vector<Entry> ropes;
+  mutex published_lock;
+  thread worker;
+  atomic<bool> running{false};
+  atomic<float> steps_per_frame{64};
+  atomic<double> frame_rate_measured{0};
+}; // class Simulation
+
+} // namespace CGL
+
+#endif // SIMULATION_H